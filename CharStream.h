@@ -9,15 +9,56 @@ For documentation refer to README.md in this directory or https://github.com/lax
 
 #pragma once
 #include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
+// a user defined CHAR_STREAM_SPRINTF without CHAR_STREAM_SNPRINTF is
+// used for bounded output too (see boundedSprintf)
 #ifndef CHAR_STREAM_SPRINTF
 #define CHAR_STREAM_SPRINTF sprintf
+#ifndef CHAR_STREAM_SNPRINTF
+#define CHAR_STREAM_SNPRINTF snprintf
+#endif
 #endif
 
 #ifndef CHAR_STREAM_BUFFER_SIZE
 #define CHAR_STREAM_BUFFER_SIZE 512
 #endif
 
+#ifndef CHAR_STREAM_LEVEL
+#define CHAR_STREAM_LEVEL 0
+#endif
+
+#ifndef CHAR_STREAM_OUTPUT_BUFFER_SIZE
+#define CHAR_STREAM_OUTPUT_BUFFER_SIZE 4096
+#endif
+
+#ifndef CHAR_STREAM_ASYNC_BUFFER_SIZE
+#define CHAR_STREAM_ASYNC_BUFFER_SIZE 65536
+#endif
+
+#ifndef CHAR_STREAM_BINARY_MAX_CALLSITES
+#define CHAR_STREAM_BINARY_MAX_CALLSITES 1024
+#endif
+
+#ifndef CHAR_STREAM_MAPPED_CHUNK_SIZE
+#define CHAR_STREAM_MAPPED_CHUNK_SIZE (16 << 20)
+#endif
+
+#ifndef CHAR_STREAM_ROTATING_SEGMENT_SIZE
+#define CHAR_STREAM_ROTATING_SEGMENT_SIZE (64 << 20)
+#endif
+
+#ifndef CHAR_STREAM_URING_BUFFER_COUNT
+#define CHAR_STREAM_URING_BUFFER_COUNT 8
+#endif
+
+#ifndef CHAR_STREAM_URING_BUFFER_SIZE
+#define CHAR_STREAM_URING_BUFFER_SIZE 65536
+#endif
+
 #ifndef CHAR_STREAM_FORMAT_BUFFER_SIZE
 #define CHAR_STREAM_FORMAT_BUFFER_SIZE 128
 #endif
@@ -26,6 +67,96 @@ For documentation refer to README.md in this directory or https://github.com/lax
 #define CHAR_STREAM_FORMAT_INDEX_TYPE uint8_t
 #endif
 
+#ifndef CHAR_STREAM_PARALLEL_CHUNK_SIZE
+#define CHAR_STREAM_PARALLEL_CHUNK_SIZE 65536
+#endif
+
+#ifndef CHAR_STREAM_COMPRESS_BLOCK_SIZE
+#define CHAR_STREAM_COMPRESS_BLOCK_SIZE 65536
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_ASYNC
+#include <atomic>
+#include <chrono>
+#include <thread>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_BINARY
+#include <atomic>
+#include <stdlib.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_PARALLEL
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <stdlib.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_TEE
+#include <tuple>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_COMPRESS
+#include <stdlib.h>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_RATE_LIMIT
+#include <atomic>
+#include <chrono>
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_HEX_DUMP
+    #if defined(__SSE2__) || defined(_M_X64)
+        #include <emmintrin.h>
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        // vqtbl1q_u8 is AArch64 only, 32-bit ARM uses the scalar loop
+        #include <arm_neon.h>
+    #endif
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_STATS
+#include <atomic>
+    #ifndef CHAR_STREAM_CYCLES
+        // time stamp counter on x86, nanoseconds elsewhere
+        #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            #include <intrin.h>
+            #define CHAR_STREAM_CYCLES() __rdtsc()
+        #elif defined(__x86_64__) || defined(__i386__)
+            #include <x86intrin.h>
+            #define CHAR_STREAM_CYCLES() __rdtsc()
+        #else
+            #include <chrono>
+            #define CHAR_STREAM_CYCLES() (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count()
+        #endif
+    #endif
+#endif
+
 #ifndef CHAR_STREAM_DISABLE_SYS_INCLUDE
     // WINDOWS (untested)
     #ifdef _WIN32
@@ -41,7 +172,138 @@ For documentation refer to README.md in this directory or https://github.com/lax
 
 
 
-class CharStream {
+// Write cursor into the target. Standard output targets are written
+// through _buff, which is flushed whenever it fills up. String
+// targets are unbounded (end is null), same as with sprintf. String
+// buffer targets are truncated at capacity, growable ones grow.
+// Passed to the writeTo function of custom parameter types.
+class CharStreamWriter {
+public:
+    void write(char const * str, size_t size) {
+        if (!fits(size) && !_flush(_stream, *this, size)) {
+            // too large for an empty buffer, bypass it
+            if (_cur == _begin && _direct(_stream, str, size)) {
+                _flushed += size;
+                return;
+            }
+            // target is full, drop the rest of this call
+            size = _end - _cur;
+            _full = true;
+        }
+        memcpy(_cur, str, size);
+        _cur += size;
+    }
+    void write(char const * str) {
+        write(str, strlen(str));
+    }
+    void write(char c) {
+        if (fits(1) || _flush(_stream, *this, 1)) *_cur++ = c;
+    }
+    // written the same as a call operator parameter
+    template <typename T>
+    void writeValue(T && value);
+    // number of bytes written so far
+    int size() const {
+        return (int)(_flushed + (_cur - _mark));
+    }
+private:
+    template <typename STREAM>
+    CharStreamWriter(STREAM * stream, char * begin, char * cur, char * end) :
+        _stream(stream),
+        _flush([](void * s, CharStreamWriter & w, size_t size) { return ((STREAM *)s)->writerFlush(w, size); }),
+        _direct([](void * s, char const * str, size_t size) { return ((STREAM *)s)->writerDirect(str, size); }),
+        _begin(begin),
+        _mark(cur),
+        _cur(cur),
+        _end(end) {}
+
+    bool fits(size_t size) const {
+        return !_end || (size_t)(_end - _cur) >= size;
+    }
+    // returns cursor with room for size bytes (size must not exceed
+    // CHAR_STREAM_BUFFER_SIZE), or null if the target is full.
+    // advance _cur after writing.
+    char * reserve(size_t size) {
+        return (fits(size) || _flush(_stream, *this, size)) ? _cur : nullptr;
+    }
+
+    void * _stream;
+    bool (*_flush)(void * stream, CharStreamWriter & w, size_t size);
+    bool (*_direct)(void * stream, char const * str, size_t size);
+    char * _begin;
+    char * _mark; // start of this call's output
+    char * _cur;
+    char * _end;
+    size_t _flushed = 0;
+    bool _full = false; // truncated, ignore further writes
+    char const * _sep = ""; // this call's separator
+
+    template <typename SINK> friend class BasicCharStream;
+};
+
+
+// Sinks
+// BasicCharStream's SINK parameter selects its output at compile time.
+// CharStreamTargetSink keeps the runtime Target of CharStream (standard
+// outputs, strings, buffers and files, checked on each call). Any other
+// sink is called directly, with no per-call check, and is either
+// - a stream sink, with write(char const * str, size_t size), which is
+//   given each call's output (or each CHAR_STREAM_BUFFER_SIZE of it) from
+//   the stream's buffer, or
+// - a window sink, written in place, with
+//   char * reserve(size_t room, char *& end): returns the write position
+//   with at least room bytes before end (end may be null for unbounded;
+//   *end must be writable, for a null-byte), or null if full. May move or
+//   commit the window.
+//   void commit(char * cur): output up to cur is complete.
+struct CharStreamTargetSink {};
+
+#ifdef CHAR_STREAM_SYSWRITE
+// Stream sink for a file descriptor, like a standard output Target
+struct CharStreamFdSink {
+    int fd;
+    CharStreamFdSink(int fd = 1) : fd(fd) {}
+    void write(char const * str, size_t size) { CHAR_STREAM_SYSWRITE(fd, str, size); }
+};
+#endif
+
+// Window sink for an unbounded char *, written from the start by each
+// call, like a char * Target
+struct CharStreamStrSink {
+    char * str;
+    CharStreamStrSink(char * str) : str(str) {}
+    char * reserve(size_t, char *& end) { end = nullptr; return str; }
+    void commit(char *) {}
+};
+
+
+// Levels, shared by all sinks
+struct CharStreamLevels {
+    enum Level : uint8_t { Debug, Info, Warn, Error, Off };
+};
+
+#ifdef CHAR_STREAM_ENABLE_STATS
+// Counters for an instance (BasicCharStream::Stats), or all instances
+// (globalStats). Cycles are CHAR_STREAM_CYCLES units, sprintfCycles
+// excludes syswrite.
+struct CharStreamStats {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+    uint64_t truncations = 0;
+    uint64_t formatCycles = 0;
+    uint64_t sprintfCycles = 0;
+    uint64_t syswriteCycles = 0;
+};
+
+// Sum of a counter over all instances, shared by all sinks
+template <uint64_t CharStreamStats::* FIELD>
+inline std::atomic<uint64_t> CharStreamGlobalStat{0};
+#endif
+
+
+template <typename SINK = CharStreamTargetSink>
+class BasicCharStream : public CharStreamLevels {
 // Public declarations
 public:
 
@@ -55,14 +317,566 @@ public:
     static constexpr char const * StringFmtInt          = "d";
     static constexpr char const * StringFmtIntLong      = "ld";
 
-    union Target {
+    static constexpr char DefaultSep[] = " ";
+    static constexpr char DefaultTrm[] = "\n";
+
+    // String buffer target with a capacity and a write cursor (size).
+    // Each call appends at size, truncating to fit capacity (which
+    // includes the terminating null-byte).
+    struct StringBuffer {
         char * str;
-        void * ptr;
-        size_t value;
-        Target(size_t value) : value(value) {}
-        Target(char * str) : str(str) {}
-        template <size_t N> Target(char (&str)[N]) : str((char *)str) {}
-        template <typename T> Target(T * value) : ptr((void *)value) {}
+        size_t capacity;
+        size_t size = 0;
+        StringBuffer(char * str, size_t capacity) : str(str), capacity(capacity) { clear(); }
+        template <size_t N> StringBuffer(char (&str)[N]) : StringBuffer(str, N) {}
+        void clear() { size = 0; str[0] = '\0'; }
+    };
+
+    // Bump allocator over user supplied memory. reset frees everything
+    // at once.
+    struct Arena {
+        char * mem;
+        size_t capacity;
+        size_t used = 0;
+        Arena(char * mem, size_t capacity) : mem(mem), capacity(capacity) {}
+        template <size_t N> Arena(char (&mem)[N]) : Arena(mem, N) {}
+        char * alloc(size_t size) {
+            if (capacity - used < size) return nullptr;
+            char * ret = mem + used;
+            used += size;
+            return ret;
+        }
+        void reset() { used = 0; }
+
+        // GrowableBuffer::Grow for an Arena. The most recent allocation
+        // is extended in place, anything else is moved to a new one.
+        static char * grow(void * arena, char * str, size_t size, size_t capacity, size_t newCapacity) {
+            Arena & a = *(Arena *)arena;
+            if (str && str + capacity == a.mem + a.used) {
+                if (a.capacity - a.used < newCapacity - capacity) return nullptr;
+                a.used += newCapacity - capacity;
+                return str;
+            }
+            char * ret = a.alloc(newCapacity);
+            if (ret && size) memcpy(ret, str, size);
+            return ret;
+        }
+    };
+
+    // String buffer target that is appended to like StringBuffer, but
+    // grows when full by requesting a larger block from an allocator
+    // (an Arena, or any user function with the Grow signature). clear
+    // keeps the storage for reuse.
+    struct GrowableBuffer {
+        // returns new storage holding the first size bytes of str, or
+        // null if the allocator is out of memory
+        using Grow = char * (*)(void * allocator, char * str, size_t size, size_t capacity, size_t newCapacity);
+
+        char * str = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        void * allocator;
+        Grow grow;
+
+        GrowableBuffer(void * allocator, Grow grow) : allocator(allocator), grow(grow) {}
+        GrowableBuffer(Arena & arena) : GrowableBuffer(&arena, Arena::grow) {}
+        void clear() { size = 0; if (str) str[0] = '\0'; }
+        // drop storage, for instance after resetting the allocator
+        void release() { str = nullptr; capacity = size = 0; }
+
+        // make sure capacity is at least minCapacity
+        bool reserve(size_t minCapacity) { return reserve(minCapacity, size); }
+        // same, keeping the first keep bytes (rather than size) if the
+        // storage moves, for text written past size but not yet committed
+        bool reserve(size_t minCapacity, size_t keep) {
+            if (minCapacity <= capacity) return true;
+            size_t newCapacity = (capacity * 2 > minCapacity) ? capacity * 2 : minCapacity;
+            char * ret = grow(allocator, str, keep, capacity, newCapacity);
+            if (!ret && newCapacity > minCapacity) {
+                newCapacity = minCapacity;
+                ret = grow(allocator, str, keep, capacity, newCapacity);
+            }
+            if (!ret) return false;
+            str = ret;
+            capacity = newCapacity;
+            return true;
+        }
+    };
+
+    #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+    // File target that is appended to through a memory-mapped window, so
+    // each call is a copy into memory rather than a write. When the window
+    // is full the file is extended and the next window (chunkSize bytes,
+    // rounded up to whole pages) is mapped. On destruction the file is
+    // truncated to the bytes written. POSIX only.
+    struct MappedFile {
+        char * str = nullptr; // window
+        size_t capacity = 0;  // window size
+        size_t size = 0;      // bytes written in window
+        size_t offset = 0;    // file offset of window
+        size_t chunkSize;
+        int fd;
+
+        MappedFile(char const * path, bool append = false, size_t chunkSize = CHAR_STREAM_MAPPED_CHUNK_SIZE) :
+            chunkSize(chunkSize),
+            fd(::open(path, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644)) {
+            if (append && fd >= 0) offset = (size_t)::lseek(fd, 0, SEEK_END);
+        }
+        MappedFile(MappedFile const &) = delete;
+        MappedFile & operator=(MappedFile const &) = delete;
+        ~MappedFile() {
+            if (str) ::munmap(str, capacity);
+            if (fd >= 0) {
+                if (::ftruncate(fd, (off_t)length())) {}
+                ::close(fd);
+            }
+        }
+        bool isOpen() const { return fd >= 0; }
+        // bytes in the file
+        size_t length() const { return offset + size; }
+        // write the window back to the file now, rather than when the
+        // kernel gets to it
+        void sync() { if (str) ::msync(str, size, MS_SYNC); }
+
+        // make sure the window has room for minRoom more bytes
+        bool reserve(size_t minRoom) {
+            if (capacity - size >= minRoom) return true;
+            if (fd < 0) return false;
+            size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+            size_t end = offset + size;
+            size_t newOffset = end - end % page;
+            size_t newCapacity = end - newOffset + minRoom;
+            if (newCapacity < chunkSize) newCapacity = chunkSize;
+            newCapacity = (newCapacity + page - 1) / page * page;
+            if (str) ::munmap(str, capacity);
+            str = nullptr;
+            capacity = size = 0;
+            offset = end;
+            if (::ftruncate(fd, (off_t)(newOffset + newCapacity))) return false;
+            void * ret = ::mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)newOffset);
+            if (ret == MAP_FAILED) return false;
+            str = (char *)ret;
+            capacity = newCapacity;
+            size = end - newOffset;
+            offset = newOffset;
+            return true;
+        }
+    };
+    #endif
+
+    #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+    // File target split into numbered segment files of segmentSize bytes,
+    // named by CHAR_STREAM_SPRINTF(name, pattern, index) (e.g.
+    // "app.%04u.log"). Moves on to the next segment when the current one
+    // is full, or after rotateSeconds (if not 0). Segments are written
+    // through memory mappings like MappedFile. A background thread
+    // creates, preallocates and maps the next segment ahead of time, and
+    // unmaps and truncates finished ones, so rotating is only a pointer
+    // swap for the calling thread. POSIX only.
+    struct RotatingFile {
+        char * str = nullptr; // current segment
+        size_t capacity = 0;
+        size_t size = 0;
+
+        RotatingFile(
+            char const * pattern, 
+            size_t segmentSize = CHAR_STREAM_ROTATING_SEGMENT_SIZE, 
+            uint32_t rotateSeconds = 0) :
+            _pattern(pattern),
+            _segmentSize(segmentSize),
+            _rotateSeconds(rotateSeconds) {
+            _current = openSegment(_index);
+            str = _current.str;
+            capacity = _current.capacity;
+            _rotateAt = std::chrono::steady_clock::now() + std::chrono::seconds(_rotateSeconds);
+            _thread = std::thread([this] { run(); });
+        }
+        RotatingFile(RotatingFile const &) = delete;
+        RotatingFile & operator=(RotatingFile const &) = delete;
+        ~RotatingFile() {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _nextReady && _retired.fd < 0; });
+                _stop = true;
+            }
+            _cv.notify_all();
+            _thread.join();
+            closeSegment(_current, size);
+            // the prepared segment was never written to
+            closeSegment(_next, 0, true);
+        }
+
+        // index of the current segment
+        uint32_t index() const { return _index; }
+
+        // make sure the current segment has room for minRoom more bytes
+        // after size + keep, rotating if it hasn't (or if rotateSeconds
+        // has passed). keep bytes after size are moved to the start of
+        // the next segment, so a line is never split between segments.
+        // Returns false, leaving the current segment in place, if there
+        // still isn't room.
+        bool reserve(size_t minRoom, size_t keep = 0) {
+            bool expired = _rotateSeconds && std::chrono::steady_clock::now() >= _rotateAt;
+            if (capacity - size - keep >= minRoom && !expired) return true;
+            {
+                // only waits if segments are filled faster than the
+                // background thread can prepare them
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _nextReady && _retired.fd < 0; });
+                if (_next.capacity < minRoom + keep) {
+                    // have another go at preparing it if it failed
+                    if (!_next.str) {
+                        _retired = _next;
+                        _retiredSize = 0;
+                        _next = Segment{};
+                        _nextReady = false;
+                        lock.unlock();
+                        _cv.notify_all();
+                    }
+                    return capacity - size - keep >= minRoom;
+                }
+                if (keep) memcpy(_next.str, str + size, keep);
+                _retired = _current;
+                _retiredSize = size;
+                _current = _next;
+                _next = Segment{};
+                _nextReady = false;
+                ++_index;
+            }
+            _cv.notify_all();
+            str = _current.str;
+            capacity = _current.capacity;
+            size = 0;
+            _rotateAt = std::chrono::steady_clock::now() + std::chrono::seconds(_rotateSeconds);
+            return true;
+        }
+
+    private:
+        struct Segment {
+            char * str = nullptr;
+            size_t capacity = 0;
+            int fd = -1; // -1 for none
+        };
+
+        Segment openSegment(uint32_t index) {
+            char name[256];
+            CHAR_STREAM_SPRINTF(name, _pattern, index);
+            Segment ret;
+            int fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return ret;
+            ret.fd = fd;
+            #ifdef __linux__
+            bool allocated = !::posix_fallocate(fd, 0, (off_t)_segmentSize);
+            #else
+            bool allocated = !::ftruncate(fd, (off_t)_segmentSize);
+            #endif
+            void * mem = allocated ? ::mmap(nullptr, _segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if (mem != MAP_FAILED) {
+                ret.str = (char *)mem;
+                ret.capacity = _segmentSize;
+            }
+            return ret;
+        }
+
+        void closeSegment(Segment & segment, size_t size, bool remove = false) {
+            if (segment.str) ::munmap(segment.str, segment.capacity);
+            if (segment.fd >= 0) {
+                if (::ftruncate(segment.fd, (off_t)size)) {}
+                ::close(segment.fd);
+                if (remove) {
+                    char name[256];
+                    CHAR_STREAM_SPRINTF(name, _pattern, _index + 1);
+                    ::unlink(name);
+                }
+            }
+            segment = Segment{};
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (;;) {
+                _cv.wait(lock, [this] { return _stop || _retired.fd >= 0 || !_nextReady; });
+                if (_retired.fd >= 0) {
+                    Segment retired = _retired;
+                    size_t retiredSize = _retiredSize;
+                    lock.unlock();
+                    closeSegment(retired, retiredSize);
+                    lock.lock();
+                    _retired = Segment{};
+                }
+                else if (!_nextReady) {
+                    uint32_t index = _index + 1;
+                    lock.unlock();
+                    Segment next = openSegment(index);
+                    lock.lock();
+                    _next = next;
+                    _nextReady = true;
+                }
+                else if (_stop) {
+                    return;
+                }
+                _cv.notify_all();
+            }
+        }
+
+        char const * _pattern;
+        size_t _segmentSize;
+        uint32_t _rotateSeconds;
+        uint32_t _index = 0;
+        std::chrono::steady_clock::time_point _rotateAt;
+        Segment _current;
+        Segment _next;
+        Segment _retired;
+        size_t _retiredSize = 0;
+        bool _nextReady = false;
+        bool _stop = false;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::thread _thread;
+    };
+    #endif
+
+    #ifdef CHAR_STREAM_ENABLE_URING
+    // File descriptor target whose output is collected in one of
+    // CHAR_STREAM_URING_BUFFER_COUNT buffers (registered with an io_uring)
+    // and written with an asynchronous fixed-buffer write once full or on
+    // flush. Writing continues in the next free buffer straight away;
+    // completions are collected when a buffer is needed, waiting only if
+    // every buffer is still being written. Writes go to the file's
+    // current position in order. Falls back to a synchronous write if
+    // the kernel doesn't support io_uring. Linux only.
+    struct UringFile {
+        char * str = nullptr; // current buffer
+        size_t capacity = 0;
+        size_t size = 0;
+        uint64_t errors = 0;  // failed writes
+
+        UringFile(int fd) : _fd(fd) {
+            void * mem = ::mmap(nullptr, BufferCount * BufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return;
+            _buffers = (char *)mem;
+            str = _buffers;
+            capacity = BufferSize;
+            off_t offset = ::lseek(fd, 0, SEEK_CUR);
+            _offset = (offset < 0) ? (uint64_t)-1 : (uint64_t)offset;
+            setup();
+        }
+        UringFile(UringFile const &) = delete;
+        UringFile & operator=(UringFile const &) = delete;
+        ~UringFile() {
+            flush();
+            while (_inFlight) waitCompletion();
+            // writes at explicit offsets don't move the file position
+            if (isAsync() && _offset != (uint64_t)-1) ::lseek(_fd, (off_t)_offset, SEEK_SET);
+            if (_ring != MAP_FAILED) ::munmap(_ring, _ringSize);
+            if (_sqes != MAP_FAILED) ::munmap(_sqes, _sqesSize);
+            if (_ringFd >= 0) ::close(_ringFd);
+            if (_buffers) ::munmap(_buffers, BufferCount * BufferSize);
+        }
+
+        // whether writes are asynchronous
+        bool isAsync() const { return _ringFd >= 0; }
+
+        // make sure the current buffer has room for minRoom more bytes,
+        // writing it out and moving to the next one if it hasn't
+        bool reserve(size_t minRoom) {
+            if (capacity - size >= minRoom) return true;
+            flush();
+            return capacity - size >= minRoom;
+        }
+
+        // start writing the current buffer, and move to the next one
+        void flush() {
+            if (!size) return;
+            if (!isAsync()) {
+                for (size_t sent = 0; sent < size;) {
+                    ssize_t ret = ::write(_fd, str + sent, size - sent);
+                    if (ret <= 0) { ++errors; break; }
+                    sent += ret;
+                }
+                size = 0;
+                return;
+            }
+            uint32_t index = (uint32_t)((str - _buffers) / BufferSize);
+            _pending[index] = {0, (uint32_t)size, _offset};
+            if (_offset != (uint64_t)-1) _offset += size;
+            ++_inFlight;
+            submit(index);
+
+            // next buffer, reaping completions until it's free
+            index = (index + 1) % BufferCount;
+            reap();
+            while (_pending[index].size) waitCompletion();
+            str = _buffers + index * BufferSize;
+            size = 0;
+        }
+
+    private:
+        static constexpr uint32_t BufferCount = CHAR_STREAM_URING_BUFFER_COUNT;
+        static constexpr size_t BufferSize = CHAR_STREAM_URING_BUFFER_SIZE;
+
+        struct Pending {
+            uint32_t sent;
+            uint32_t size; // 0 when free
+            uint64_t offset;
+        };
+
+        void setup() {
+            io_uring_params params = {};
+            _ringFd = (int)::syscall(__NR_io_uring_setup, BufferCount, &params);
+            if (_ringFd < 0) return;
+            size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            _ringSize = (sqSize > cqSize) ? sqSize : cqSize;
+            _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            iovec iov[BufferCount];
+            for (uint32_t i = 0; i < BufferCount; ++i) iov[i] = {_buffers + i * BufferSize, BufferSize};
+            // one mapping for both rings needs IORING_FEAT_SINGLE_MMAP
+            // (5.4), and writes to the current position of non-seekable
+            // files IORING_FEAT_RW_CUR_POS (5.6)
+            uint32_t features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+            if ((params.features & features) == features) {
+                _ring = ::mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+                _sqes = ::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+            }
+            if (_ring == MAP_FAILED || _sqes == MAP_FAILED ||
+                ::syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_BUFFERS, iov, BufferCount) < 0) {
+                ::close(_ringFd);
+                _ringFd = -1;
+                return;
+            }
+            char * ring = (char *)_ring;
+            _sqTail = (uint32_t *)(ring + params.sq_off.tail);
+            _sqMask = *(uint32_t *)(ring + params.sq_off.ring_mask);
+            _sqArray = (uint32_t *)(ring + params.sq_off.array);
+            _cqHead = (uint32_t *)(ring + params.cq_off.head);
+            _cqTail = (uint32_t *)(ring + params.cq_off.tail);
+            _cqMask = *(uint32_t *)(ring + params.cq_off.ring_mask);
+            _cqes = (io_uring_cqe *)(ring + params.cq_off.cqes);
+        }
+
+        // queue a write of the unsent part of buffer index. Non-seekable
+        // files are written in order by draining earlier writes first.
+        void submit(uint32_t index) {
+            Pending & p = _pending[index];
+            uint32_t tail = *_sqTail;
+            uint32_t slot = tail & _sqMask;
+            io_uring_sqe & sqe = ((io_uring_sqe *)_sqes)[slot];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_WRITE_FIXED;
+            sqe.fd = _fd;
+            sqe.addr = (uint64_t)(uintptr_t)(_buffers + index * BufferSize + p.sent);
+            sqe.len = p.size - p.sent;
+            sqe.off = (p.offset == (uint64_t)-1) ? p.offset : p.offset + p.sent;
+            sqe.buf_index = (uint16_t)index;
+            sqe.user_data = index;
+            if (p.offset == (uint64_t)-1) sqe.flags = IOSQE_IO_DRAIN;
+            _sqArray[slot] = slot;
+            __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+            if (enter(1, 0, 0) < 0) {
+                // never queued
+                __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+                complete(index, -1);
+            }
+        }
+
+        // handle all available completions
+        void reap() {
+            uint32_t head = *_cqHead;
+            while (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe & cqe = _cqes[head & _cqMask];
+                uint32_t index = (uint32_t)cqe.user_data;
+                int32_t res = cqe.res;
+                __atomic_store_n(_cqHead, ++head, __ATOMIC_RELEASE);
+                complete(index, res);
+            }
+        }
+
+        void waitCompletion() {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+            reap();
+        }
+
+        long enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags) {
+            long ret;
+            do {
+                ret = ::syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, flags, nullptr, 0);
+            } while (ret < 0 && errno == EINTR);
+            return ret;
+        }
+
+        void complete(uint32_t index, int32_t res) {
+            Pending & p = _pending[index];
+            if (res > 0 && p.sent + (uint32_t)res < p.size) {
+                // short write, queue the rest
+                p.sent += res;
+                submit(index);
+                return;
+            }
+            if (res <= 0) ++errors;
+            p.size = 0;
+            --_inFlight;
+        }
+
+        int _fd;
+        int _ringFd = -1;
+        char * _buffers = nullptr;
+        uint64_t _offset; // -1 for non-seekable
+        uint32_t _inFlight = 0;
+        Pending _pending[BufferCount] = {};
+        void * _ring = MAP_FAILED;
+        size_t _ringSize = 0;
+        void * _sqes = MAP_FAILED;
+        size_t _sqesSize = 0;
+        uint32_t * _sqTail = nullptr;
+        uint32_t _sqMask = 0;
+        uint32_t * _sqArray = nullptr;
+        uint32_t * _cqHead = nullptr;
+        uint32_t * _cqTail = nullptr;
+        uint32_t _cqMask = 0;
+        io_uring_cqe * _cqes = nullptr;
+    };
+    #endif
+
+    struct Target {
+        enum Kind : uint8_t { Value, String, Pointer, Buffer, Growable, Mapped, Rotating, Uring };
+        union {
+            char * str;
+            void * ptr;
+            size_t value;
+            StringBuffer * buffer;
+            GrowableBuffer * growable;
+            #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+            MappedFile * mapped;
+            #endif
+            #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+            RotatingFile * rotating;
+            #endif
+            #ifdef CHAR_STREAM_ENABLE_URING
+            UringFile * uring;
+            #endif
+        };
+        Kind kind;
+        Target(size_t value) : value(value), kind(Value) {}
+        Target(char * str) : str(str), kind(String) {}
+        template <size_t N> Target(char (&str)[N]) : str((char *)str), kind(String) {}
+        Target(StringBuffer & buffer) : buffer(&buffer), kind(Buffer) {}
+        Target(StringBuffer * buffer) : buffer(buffer), kind(Buffer) {}
+        Target(GrowableBuffer & growable) : growable(&growable), kind(Growable) {}
+        Target(GrowableBuffer * growable) : growable(growable), kind(Growable) {}
+        #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+        Target(MappedFile & mapped) : mapped(&mapped), kind(Mapped) {}
+        Target(MappedFile * mapped) : mapped(mapped), kind(Mapped) {}
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+        Target(RotatingFile & rotating) : rotating(&rotating), kind(Rotating) {}
+        Target(RotatingFile * rotating) : rotating(rotating), kind(Rotating) {}
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_URING
+        Target(UringFile & uring) : uring(&uring), kind(Uring) {}
+        Target(UringFile * uring) : uring(uring), kind(Uring) {}
+        #endif
+        template <typename T> Target(T * value) : ptr((void *)value), kind(Pointer) {}
         friend bool operator ==(Target const & a, size_t b) { return a.value == b; }
         friend bool operator ==(Target const & a, void * b) { return a.ptr   == b; }
     };
@@ -71,24 +885,105 @@ public:
     static constexpr int Out = 1;
     static constexpr int Err = 2;
 
+
+    #ifdef CHAR_STREAM_ENABLE_STATS
+    using Stats = CharStreamStats;
+    #endif
+
+    #ifdef CHAR_STREAM_ENABLE_SHORTEST_FLOAT
+    // Float parameter written as the shortest string that reads back as
+    // the same value, or with precision digits after the decimal point.
+    struct Float {
+        Float(double value, int precision = -1) {
+            size = (precision < 0) ? shortest(str, value) : fixed(str, value, precision);
+        }
+        Float(float value, int precision = -1) {
+            size = (precision < 0) ? shortest(str, value) : fixed(str, value, precision);
+        }
+        operator char const * () const { return str; }
+        // large enough for fixed(DBL_MAX, FloatMaxPrecision)
+        char str[336];
+        int size;
+    };
+    // so that 10^precision fits in a uint64_t
+    static constexpr int FloatMaxPrecision = 19;
+    #endif
+
 // Instance API
 public:
 
     // Constructor
-    CharStream(Target target = Out, char const * sep = " ", char const * trm = "\n") : 
+    template <typename S = SINK, typename = std::enable_if_t<std::is_same_v<S, CharStreamTargetSink>>>
+    BasicCharStream(Target target = Out, char const * sep = DefaultSep, char const * trm = DefaultTrm) : 
         _target(target), 
         _targetIsSTD(_target == In || _target == Out || _target == Err), 
         _sep(sep), 
         _trm(trm) {}
+    template <typename S = SINK, typename = std::enable_if_t<!std::is_same_v<S, CharStreamTargetSink>>>
+    BasicCharStream(SINK sink, char const * sep = DefaultSep, char const * trm = DefaultTrm) : 
+        _target((char *)nullptr), 
+        _targetIsSTD(false), 
+        _sep(sep), 
+        _trm(trm),
+        _sink(std::move(sink)) {}
+
+    // the sink, for sinks other than CharStreamTargetSink
+    SINK & sink() { return _sink; }
+
+    #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+    // Destructor
+    ~BasicCharStream() {
+        flush();
+    }
+    #endif
 
     // Callop ()
     int operator () () {
-        return targetSprintf("%s", _trm);
+        return terminated(targetSprintf("%s", _trm));
     }
     template <typename ... TS>
     int operator () (TS && ... params) {
-        writeFormat(_sep, _trm, sizeof...(params), static_cast<TS &&>(params)...);
-        return targetSprintf(_formatBuff, static_cast<TS &&>(params)...);
+        if constexpr (writeNatively<TS...>()) {
+            return terminated(nativeWrite(_sep, _trm, sizeof...(params), static_cast<TS &&>(params)...));
+        }
+        else {
+            #if defined(CHAR_STREAM_ENABLE_STATIC_FORMAT)
+            return terminated(staticSprintf(_sep, _trm, sizeof...(params), static_cast<TS &&>(params)...));
+            #else
+            writeFormat(_sep, _trm, sizeof...(params), static_cast<TS &&>(params)...);
+            return terminated(targetSprintf(_formatBuff, static_cast<TS &&>(params)...));
+            #endif
+        }
+    }
+
+    // Levels
+    // Calls below CHAR_STREAM_LEVEL compile to nothing, calls below the
+    // instance level return 0 before doing anything.
+    template <typename ... TS> int debug(TS && ... params) { return level<Debug>(static_cast<TS &&>(params)...); }
+    template <typename ... TS> int info (TS && ... params) { return level<Info >(static_cast<TS &&>(params)...); }
+    template <typename ... TS> int warn (TS && ... params) { return level<Warn >(static_cast<TS &&>(params)...); }
+    template <typename ... TS> int error(TS && ... params) { return level<Error>(static_cast<TS &&>(params)...); }
+
+    // CHAR_STREAM_LEVEL as a constant rather than a literal, so comparing
+    // with the default of 0 doesn't warn that it is always true
+    static constexpr int CompiledLevel = CHAR_STREAM_LEVEL;
+
+    void setLevel(Level level) { _level = level; }
+    Level level() const { return _level; }
+    bool enabled(Level level) const { return level >= CompiledLevel && level >= _level; }
+
+    // the level given as a template argument, used by the level macros
+    template <Level LEVEL, typename ... TS>
+    int level(TS && ... params) {
+        if constexpr (LEVEL < CompiledLevel) return 0;
+        else if (LEVEL < _level) return 0;
+        else if constexpr (HasCallLevel<SINK>::value) {
+            _sink.callLevel(LEVEL);
+            int ret = (*this)(static_cast<TS &&>(params)...);
+            _sink.callLevel(Off);
+            return ret;
+        }
+        else return (*this)(static_cast<TS &&>(params)...);
     }
 
     // Format
@@ -100,13 +995,66 @@ public:
     // Write
     template <typename ... TS>
     int write(char const * sep, TS && ... params) {
-        writeFormat(sep, "", sizeof...(params) - 1, static_cast<TS &&>(params)...);
-        return targetSprintf(_formatBuff, static_cast<TS &&>(params)...);
+        if constexpr (writeNatively<TS...>()) {
+            return nativeWrite(sep, "", sizeof...(params) - 1, static_cast<TS &&>(params)...);
+        }
+        else {
+            #if defined(CHAR_STREAM_ENABLE_STATIC_FORMAT)
+            return staticSprintf(sep, "", sizeof...(params) - 1, static_cast<TS &&>(params)...);
+            #else
+            writeFormat(sep, "", sizeof...(params) - 1, static_cast<TS &&>(params)...);
+            return targetSprintf(_formatBuff, static_cast<TS &&>(params)...);
+            #endif
+        }
+    }
+
+    #ifdef CHAR_STREAM_ENABLE_STATS
+    // Stats
+    // Snapshot of this instance's counters, or the sum of all instances'
+    // since the program started. Global counters are updated atomically.
+    Stats stats() const { return _stats; }
+    void resetStats() { _stats = Stats{}; }
+    static Stats globalStats() {
+        Stats ret;
+        ret.calls           = globalStat<&Stats::calls>();
+        ret.bytes           = globalStat<&Stats::bytes>();
+        ret.syscalls        = globalStat<&Stats::syscalls>();
+        ret.truncations     = globalStat<&Stats::truncations>();
+        ret.formatCycles    = globalStat<&Stats::formatCycles>();
+        ret.sprintfCycles   = globalStat<&Stats::sprintfCycles>();
+        ret.syswriteCycles  = globalStat<&Stats::syswriteCycles>();
+        return ret;
     }
+    #endif
+
+    #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+    // Buffer
+    // Standard output writes are collected and written once flushSize
+    // bytes or flushLines terminators (if not 0) are reached, when flush
+    // is called, or on destruction. flushSize 0 disables buffering.
+    void buffer(size_t flushSize = CHAR_STREAM_OUTPUT_BUFFER_SIZE, uint32_t flushLines = 0) {
+        flush();
+        _flushSize = (flushSize < CHAR_STREAM_OUTPUT_BUFFER_SIZE) ? flushSize : CHAR_STREAM_OUTPUT_BUFFER_SIZE;
+        _flushLines = flushLines;
+    }
+
+    // Flush
+    void flush() {
+        if (_outSize) syswrite(_outBuff, _outSize);
+        _outSize = 0;
+        _lines = 0;
+    }
+    #endif
 
 // Private utilities
 private:
 
+    // Sinks that are told the level of level calls (CharStreamTee)
+    template <typename S, typename = void>
+    struct HasCallLevel : std::false_type {};
+    template <typename S>
+    struct HasCallLevel<S, std::void_t<decltype(std::declval<S &>().callLevel(Level()))>> : std::true_type {};
+
     template <typename ... TS>
     void writeFormat(
         char const * sep, 
@@ -114,6 +1062,9 @@ private:
         CHAR_STREAM_FORMAT_INDEX_TYPE paramCount, 
         TS && ... params) {
 
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        StatsTimer<&Stats::formatCycles> timer{this};
+        #endif
         CHAR_STREAM_FORMAT_INDEX_TYPE fbuffIndex = 0;
         CHAR_STREAM_FORMAT_INDEX_TYPE paramIndex = 0;
         (writeFormatItem(sep, trm, fbuffIndex, paramIndex, paramCount, params), ...);
@@ -147,8 +1098,9 @@ private:
     }
 
     #define EXPECTED_TYPE(EXPECTED_TYPE, VALUE, RETURN_VALUE, FORMAT_CHAR) \
-    auto coerceToExpectedParam(EXPECTED_TYPE const & VALUE) -> decltype(RETURN_VALUE) { return RETURN_VALUE; } \
-    char const * charForType(EXPECTED_TYPE) { return FORMAT_CHAR; }
+    static auto coerceToExpectedParam(EXPECTED_TYPE const & VALUE) -> decltype(RETURN_VALUE) { return RETURN_VALUE; } \
+    static constexpr char const * charForType(EXPECTED_TYPE) { return FORMAT_CHAR; } \
+    static EXPECTED_TYPE expectedType(EXPECTED_TYPE);
     //
     EXPECTED_TYPE(             float, t,                            t, StringFmtFloat)
     EXPECTED_TYPE(            double, t,                            t, StringFmtFloat)
@@ -170,21 +1122,252 @@ private:
     EXPECTED_TYPE(           int64_t, t,                            t, StringFmtIntLong)
     EXPECTED_TYPE(      char const *, t,                            t, StringFmtString)
 
+    // type each parameter is coerced to, resolved at compile time with
+    // the same overload rules as coerceToExpectedParam
+    template <typename T>
+    using ExpectedType = decltype(expectedType(std::declval<T>()));
+
+    static constexpr bool IsTargetSink = std::is_same_v<SINK, CharStreamTargetSink>;
+
+    // Sinks written in place, with reserve and commit
+    template <typename S, typename = void>
+    struct IsWindowSink : std::false_type {};
+    template <typename S>
+    struct IsWindowSink<S, std::void_t<decltype(std::declval<S &>().reserve(size_t(), std::declval<char *&>()))>> : std::true_type {};
+
+    // Output is written through _buff (or _outBuff) to syswrite: standard
+    // outputs, and stream sinks
+    bool streamed() const {
+        if constexpr (IsTargetSink) return _targetIsSTD;
+        else return !IsWindowSink<SINK>::value;
+    }
+
     template <typename ... TS>
     int targetSprintf(char const *fmt, TS && ... params) {
-        int ret;
-        if (_targetIsSTD) {
-            #ifdef CHAR_STREAM_SYSWRITE
-            ret = CHAR_STREAM_SPRINTF(_buff, fmt, coerceToExpectedParam(static_cast<TS &&>(params))...);
-            CHAR_STREAM_SYSWRITE(_target.value, _buff, ret);
-            #endif
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        StatsTimer<&Stats::sprintfCycles> timer{this};
+        #endif
+        int ret = 0;
+        #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+        if (streamed() && _flushSize) {
+            if (CHAR_STREAM_OUTPUT_BUFFER_SIZE - _outSize < CHAR_STREAM_BUFFER_SIZE) flush();
+            size_t room = CHAR_STREAM_OUTPUT_BUFFER_SIZE - _outSize;
+            ret = boundedSprintf(_outBuff + _outSize, room, fmt, static_cast<TS &&>(params)...);
+            if ((size_t)ret >= room && _outSize) {
+                // longer than the room left, again into the empty buffer
+                flush();
+                room = CHAR_STREAM_OUTPUT_BUFFER_SIZE;
+                ret = boundedSprintf(_outBuff, room, fmt, static_cast<TS &&>(params)...);
+            }
+            if ((size_t)ret >= room) {
+                ret = (int)room - 1;
+                #ifdef CHAR_STREAM_ENABLE_STATS
+                count<&Stats::truncations>(1);
+                #endif
+            }
+            _outSize += ret;
+            if (_outSize >= _flushSize) flush();
+            return counted(ret);
+        }
+        #endif
+        if (streamed()) {
+            ret = buffSprintf(fmt, static_cast<TS &&>(params)...);
+            syswrite(_buff, ret);
+        }
+        else if constexpr (IsWindowSink<SINK>::value) {
+            char * end;
+            if (char * str = _sink.reserve(CHAR_STREAM_BUFFER_SIZE, end)) {
+                if (!end) {
+                    // unbounded, like a char * Target
+                    ret = CHAR_STREAM_SPRINTF(str, fmt, coerceToExpectedParam(static_cast<TS &&>(params))...);
+                }
+                else {
+                    // *end takes the null-byte
+                    ret = boundedSprintf(str, end - str + 1, fmt, static_cast<TS &&>(params)...);
+                    if (ret > end - str) {
+                        ret = (int)(end - str);
+                        #ifdef CHAR_STREAM_ENABLE_STATS
+                        count<&Stats::truncations>(1);
+                        #endif
+                    }
+                }
+                _sink.commit(str + ret);
+            }
+            else {
+                // not enough room, truncate through a Writer
+                ret = buffSprintf(fmt, static_cast<TS &&>(params)...);
+                Writer w = targetWriter();
+                w.write(_buff, ret);
+                ret = targetFinish(w);
+            }
         }
+        else if (_target.kind == Target::Buffer) {
+            StringBuffer & b = *_target.buffer;
+            ret = appendSprintf(b.str, b.size, b.capacity, NoRoom, fmt, static_cast<TS &&>(params)...);
+        }
+        else if (_target.kind == Target::Growable) {
+            GrowableBuffer & g = *_target.growable;
+            g.reserve(g.size + CHAR_STREAM_BUFFER_SIZE + 1);
+            auto grow = [&](size_t length) { return g.reserve(g.size + length); };
+            ret = appendSprintf(g.str, g.size, g.capacity, grow, fmt, static_cast<TS &&>(params)...);
+        }
+        #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+        else if (_target.kind == Target::Mapped) {
+            MappedFile & m = *_target.mapped;
+            m.reserve(CHAR_STREAM_BUFFER_SIZE + 1);
+            // remaps the window even if it fails
+            auto remap = [&](size_t length) { m.reserve(length); return true; };
+            ret = appendSprintf(m.str, m.size, m.capacity, remap, fmt, static_cast<TS &&>(params)...);
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+        else if (_target.kind == Target::Rotating) {
+            RotatingFile & r = *_target.rotating;
+            r.reserve(CHAR_STREAM_BUFFER_SIZE + 1);
+            // rotates to a segment with room for the whole line, if there
+            // can be one
+            auto rotate = [&](size_t length) { return r.reserve(length); };
+            ret = appendSprintf(r.str, r.size, r.capacity, rotate, fmt, static_cast<TS &&>(params)...);
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_URING
+        else if (_target.kind == Target::Uring) {
+            UringFile & u = *_target.uring;
+            u.reserve(CHAR_STREAM_BUFFER_SIZE + 1);
+            // moves on to the next buffer even if it fails, never writing
+            // into one that is still being written
+            auto next = [&](size_t length) { u.reserve(length); return true; };
+            ret = appendSprintf(u.str, u.size, u.capacity, next, fmt, static_cast<TS &&>(params)...);
+        }
+        #endif
         else {
             ret = CHAR_STREAM_SPRINTF(_target.str, fmt, coerceToExpectedParam(static_cast<TS &&>(params))...);
         }
+        return counted(ret);
+    }
+
+    // Formats into str, never past capacity bytes (null-byte included).
+    // Returns the length of the whole output, which is more than was
+    // written if it was truncated.
+    template <typename ... TS>
+    int boundedSprintf(char * str, size_t capacity, char const *fmt, TS && ... params) {
+        #ifdef CHAR_STREAM_SNPRINTF
+        int ret = CHAR_STREAM_SNPRINTF(str, capacity, fmt, coerceToExpectedParam(static_cast<TS &&>(params))...);
+        return (ret < 0) ? 0 : ret;
+        #else
+        // only CHAR_STREAM_SPRINTF, formatted into _buff (which the
+        // output must fit) then copied
+        int ret = CHAR_STREAM_SPRINTF(_buff, fmt, coerceToExpectedParam(static_cast<TS &&>(params))...);
+        if (ret < 0) return 0;
+        if (str != _buff) {
+            size_t size = ((size_t)ret < capacity) ? (size_t)ret : capacity - 1;
+            memcpy(str, _buff, size);
+            str[size] = '\0';
+        }
+        return ret;
+        #endif
+    }
+
+    // Formats into _buff, truncating to CHAR_STREAM_BUFFER_SIZE - 1 bytes
+    template <typename ... TS>
+    int buffSprintf(char const *fmt, TS && ... params) {
+        int ret = boundedSprintf(_buff, sizeof(_buff), fmt, static_cast<TS &&>(params)...);
+        if ((size_t)ret < sizeof(_buff)) return ret;
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        count<&Stats::truncations>(1);
+        #endif
+        return (int)sizeof(_buff) - 1;
+    }
+
+    // Appends to str in place, never past capacity (keeping room for a
+    // null-byte). If the output doesn't fit, makeRoom(length) is called
+    // with its whole length, and returns whether the target's str, size
+    // or capacity may have changed, in which case it's formatted again.
+    // Output that still doesn't fit is truncated.
+    static bool NoRoom(size_t) { return false; }
+    template <typename MAKE_ROOM, typename ... TS>
+    int appendSprintf(char * const & str, size_t & size, size_t const & capacity, MAKE_ROOM && makeRoom, char const *fmt, TS && ... params) {
+        if (capacity <= size) return 0;
+        int ret = boundedSprintf(str + size, capacity - size, fmt, static_cast<TS &&>(params)...);
+        if ((size_t)ret >= capacity - size) {
+            bool moved = makeRoom((size_t)ret + 1);
+            if (capacity <= size) return 0;
+            if (moved) ret = boundedSprintf(str + size, capacity - size, fmt, static_cast<TS &&>(params)...);
+        }
+        if ((size_t)ret >= capacity - size) {
+            ret = (int)(capacity - size - 1);
+            #ifdef CHAR_STREAM_ENABLE_STATS
+            count<&Stats::truncations>(1);
+            #endif
+        }
+        size += ret;
+        return ret;
+    }
+
+    // called after each write of the terminus string
+    int terminated(int ret) {
+        #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+        if (_flushLines && ++_lines >= _flushLines) flush();
+        #endif
+        return ret;
+    }
+
+    // called once per call with the number of bytes written
+    int counted(int ret) {
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        count<&Stats::calls>(1);
+        count<&Stats::bytes>(ret);
+        #endif
         return ret;
     }
 
+    // all writes to a standard output or stream sink
+    void syswrite(char const * str, size_t size) {
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        uint64_t start = CHAR_STREAM_CYCLES();
+        #endif
+        if constexpr (IsTargetSink) {
+            #ifdef CHAR_STREAM_SYSWRITE
+            CHAR_STREAM_SYSWRITE(_target.value, str, size);
+            #else
+            return;
+            #endif
+        }
+        else if constexpr (!IsWindowSink<SINK>::value) {
+            _sink.write(str, size);
+        }
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        count<&Stats::syscalls>(1);
+        count<&Stats::syswriteCycles>(CHAR_STREAM_CYCLES() - start);
+        #endif
+    }
+
+    #ifdef CHAR_STREAM_ENABLE_STATS
+    template <uint64_t Stats::* FIELD>
+    void count(uint64_t n) {
+        _stats.*FIELD += n;
+        globalStat<FIELD>().fetch_add(n, std::memory_order_relaxed);
+    }
+
+    template <uint64_t Stats::* FIELD>
+    static std::atomic<uint64_t> & globalStat() {
+        return CharStreamGlobalStat<FIELD>;
+    }
+
+    // Adds the cycles spent in its scope, less any spent in syswrite, to
+    // FIELD.
+    template <uint64_t Stats::* FIELD>
+    struct StatsTimer {
+        BasicCharStream * stream;
+        uint64_t start = CHAR_STREAM_CYCLES();
+        uint64_t syswriteCycles = stream->_stats.syswriteCycles;
+        ~StatsTimer() {
+            uint64_t syswrite = stream->_stats.syswriteCycles - syswriteCycles;
+            stream->count<FIELD>(CHAR_STREAM_CYCLES() - start - syswrite);
+        }
+    };
+    #endif
+
 // Private static utilities
 private:
 
@@ -201,19 +1384,2344 @@ private:
         return i;
     }
 
-// Instance storage
+    static constexpr size_t slen(char const * str) {
+        size_t i = 0;
+        while (str[i] != '\0') ++i;
+        return i;
+    }
+
+#ifdef CHAR_STREAM_ENABLE_STATIC_FORMAT
+// Compile-time format strings
 private:
-    Target _target;
-    bool _targetIsSTD;
-    char const * _sep;
-    char const * _trm;
-    char _buff[CHAR_STREAM_BUFFER_SIZE];
-    char _formatBuff[CHAR_STREAM_FORMAT_BUFFER_SIZE];
 
-};
+    // Format string built at compile time for a parameter type list.
+    // Each parameter is followed by DefaultSep, or DefaultTrm after the
+    // last one, if DEFAULTS. Otherwise a "%s" placeholder is written in
+    // their place, to be filled by the instance (or write) strings at call
+    // time. (A bool rather than nullable SEP/TRM pointers, which can't be
+    // compared with null in a constant expression under all compilers.)
+    template <bool DEFAULTS, typename ... TS>
+    struct StaticFormat {
+        static constexpr size_t SepSize = DEFAULTS ? sizeof(DefaultSep) - 1 : 2;
+        static constexpr size_t TrmSize = DEFAULTS ? sizeof(DefaultTrm) - 1 : 2;
+        static constexpr size_t Size =
+            (0 + ... + (1 + slen(charForType(ExpectedType<TS>{})))) +
+            SepSize * (sizeof...(TS) - 1) + TrmSize + 1;
 
+        char value[Size] = {'\0'};
 
-#ifdef CHAR_STREAM_ENABLE_OPERATOR_MACRO
+        constexpr StaticFormat() {
+            size_t i = 0;
+            size_t paramIndex = 0;
+            char const * types[] = {charForType(ExpectedType<TS>{})...};
+            for (char const * type : types) {
+                value[i++] = '%';
+                for (; *type; ++type) value[i++] = *type;
+                if constexpr (DEFAULTS) {
+                    char const * sepOrTrm = (paramIndex < sizeof...(TS) - 1) ? DefaultSep : DefaultTrm;
+                    for (; *sepOrTrm; ++sepOrTrm) value[i++] = *sepOrTrm;
+                }
+                else {
+                    value[i++] = '%';
+                    value[i++] = 's';
+                }
+                ++paramIndex;
+            }
+            value[i] = '\0';
+        }
+    };
+    template <bool DEFAULTS, typename ... TS>
+    static constexpr StaticFormat<DEFAULTS, TS...> staticFormat{};
+
+    // Single sprintf with a compile-time format. Default sep/trm are
+    // spliced into the format, otherwise they're passed as "%s" params.
+    template <typename ... TS>
+    int staticSprintf(
+        char const * sep, 
+        char const * trm, 
+        size_t paramCount, 
+        TS && ... params) {
+
+        if (sep == DefaultSep && trm == DefaultTrm && paramCount == sizeof...(TS)) {
+            return targetSprintf(
+                staticFormat<true, TS...>.value, 
+                static_cast<TS &&>(params)...);
+        }
+        return staticSprintfInterleaved(
+            std::make_index_sequence<sizeof...(TS) * 2>{}, 
+            sep, trm, paramCount, static_cast<TS &&>(params)...);
+    }
+
+    template <size_t ... I, typename ... TS>
+    int staticSprintfInterleaved(
+        std::index_sequence<I...>,
+        char const * sep, 
+        char const * trm, 
+        size_t paramCount, 
+        TS && ... params) {
+
+        return targetSprintf(
+            staticFormat<false, TS...>.value, 
+            interleavedParam<I>(sep, trm, paramCount, static_cast<TS &&>(params)...)...);
+    }
+
+    // even indexes are parameters, odd indexes the seperator or
+    // terminator string following them (see writeFormatItem)
+    template <size_t I, typename ... TS>
+    static decltype(auto) interleavedParam(
+        char const * sep, 
+        char const * trm, 
+        size_t paramCount, 
+        TS && ... params) {
+
+        if constexpr (I % 2 == 0) {
+            return nthParam<I / 2>(static_cast<TS &&>(params)...);
+        }
+        else {
+            constexpr size_t paramIndex = I / 2;
+            return
+                (paramIndex <  paramCount-1) ? sep :
+                (paramIndex == paramCount-1) ? trm :
+                "";
+        }
+    }
+
+    template <size_t I, typename T, typename ... TS>
+    static decltype(auto) nthParam(T && param, TS && ... params) {
+        if constexpr (I == 0) return static_cast<T &&>(param);
+        else return nthParam<I - 1>(static_cast<TS &&>(params)...);
+    }
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_SHORTEST_FLOAT
+// Float formatting
+public:
+
+    // Writes the shortest string that reads back as exactly value, using
+    // Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly
+    // and Accurately with Integers"). Always round-trips; in rare cases
+    // one digit longer than the shortest. Fixed notation (1.5, 100.0,
+    // 0.001) is used for decimal exponents -4 to 15, otherwise 1.5e+16.
+    // Returns length, not counting terminating null-byte.
+    static int shortest(char * dst, double value) {
+        return shortestImpl<double, uint64_t>(dst, value);
+    }
+    static int shortest(char * dst, float value) {
+        return shortestImpl<float, uint32_t>(dst, value);
+    }
+
+    // Writes value with precision (up to FloatMaxPrecision) digits after
+    // the decimal point, like "%.*f". Can differ from sprintf in the
+    // last digit when value is within rounding error of halfway, and
+    // digits past the 17th significant one are written as zeros. Returns
+    // length, not counting terminating null-byte.
+    static int fixed(char * dst, double value, int precision) {
+        if (precision < 0) precision = 0;
+        if (precision > FloatMaxPrecision) precision = FloatMaxPrecision;
+        char * p = dst;
+        if (int ret = nonFinite(p, value)) return ret;
+        if (signBit<double, uint64_t>(value)) {
+            *p++ = '-';
+            value = -value;
+        }
+
+        double scaled = value * Pow10[precision];
+        if (scaled < 1e19) {
+            // round half to even, like printf
+            uint64_t n = (uint64_t)scaled;
+            double remainder = scaled - (double)n;
+            if (remainder > 0.5 || (remainder == 0.5 && (n & 1))) ++n;
+            uint64_t scale = (uint64_t)Pow10[precision];
+            p += writeUint(p, n / scale);
+            if (precision) {
+                *p++ = '.';
+                uint64_t fraction = n % scale;
+                for (int i = precision - 1; i >= 0; --i) {
+                    p[i] = (char)('0' + fraction % 10);
+                    fraction /= 10;
+                }
+                p += precision;
+            }
+        }
+        else {
+            // at least 20 digits up to the precision digit, so all of the
+            // (at most 17) shortest digits are in range
+            char digits[18];
+            int exponent;
+            int length = shortestDigits<double, uint64_t>(digits, exponent, value);
+            int point = length + exponent;
+            int i = 0;
+            for (; i < point; ++i) *p++ = (i < length) ? digits[i] : '0';
+            if (precision) {
+                *p++ = '.';
+                for (int j = 0; j < precision; ++j, ++i) *p++ = (i >= 0 && i < length) ? digits[i] : '0';
+            }
+        }
+        *p = '\0';
+        return (int)(p - dst);
+    }
+
+private:
+
+    struct DiyFp {
+        uint64_t f;
+        int e;
+    };
+
+    struct CachedPower {
+        uint64_t f;
+        int16_t e;
+        int16_t k;
+    };
+
+    // normalized 10^k for k = -300, -292, ..., 324
+    static constexpr CachedPower CachedPowers[] = {
+        {0xAB70FE17C79AC6CA, -1060, -300},
+        {0xFF77B1FCBEBCDC4F, -1034, -292},
+        {0xBE5691EF416BD60C, -1007, -284},
+        {0x8DD01FAD907FFC3C,  -980, -276},
+        {0xD3515C2831559A83,  -954, -268},
+        {0x9D71AC8FADA6C9B5,  -927, -260},
+        {0xEA9C227723EE8BCB,  -901, -252},
+        {0xAECC49914078536D,  -874, -244},
+        {0x823C12795DB6CE57,  -847, -236},
+        {0xC21094364DFB5637,  -821, -228},
+        {0x9096EA6F3848984F,  -794, -220},
+        {0xD77485CB25823AC7,  -768, -212},
+        {0xA086CFCD97BF97F4,  -741, -204},
+        {0xEF340A98172AACE5,  -715, -196},
+        {0xB23867FB2A35B28E,  -688, -188},
+        {0x84C8D4DFD2C63F3B,  -661, -180},
+        {0xC5DD44271AD3CDBA,  -635, -172},
+        {0x936B9FCEBB25C996,  -608, -164},
+        {0xDBAC6C247D62A584,  -582, -156},
+        {0xA3AB66580D5FDAF6,  -555, -148},
+        {0xF3E2F893DEC3F126,  -529, -140},
+        {0xB5B5ADA8AAFF80B8,  -502, -132},
+        {0x87625F056C7C4A8B,  -475, -124},
+        {0xC9BCFF6034C13053,  -449, -116},
+        {0x964E858C91BA2655,  -422, -108},
+        {0xDFF9772470297EBD,  -396, -100},
+        {0xA6DFBD9FB8E5B88F,  -369,  -92},
+        {0xF8A95FCF88747D94,  -343,  -84},
+        {0xB94470938FA89BCF,  -316,  -76},
+        {0x8A08F0F8BF0F156B,  -289,  -68},
+        {0xCDB02555653131B6,  -263,  -60},
+        {0x993FE2C6D07B7FAC,  -236,  -52},
+        {0xE45C10C42A2B3B06,  -210,  -44},
+        {0xAA242499697392D3,  -183,  -36},
+        {0xFD87B5F28300CA0E,  -157,  -28},
+        {0xBCE5086492111AEB,  -130,  -20},
+        {0x8CBCCC096F5088CC,  -103,  -12},
+        {0xD1B71758E219652C,   -77,   -4},
+        {0x9C40000000000000,   -50,    4},
+        {0xE8D4A51000000000,   -24,   12},
+        {0xAD78EBC5AC620000,     3,   20},
+        {0x813F3978F8940984,    30,   28},
+        {0xC097CE7BC90715B3,    56,   36},
+        {0x8F7E32CE7BEA5C70,    83,   44},
+        {0xD5D238A4ABE98068,   109,   52},
+        {0x9F4F2726179A2245,   136,   60},
+        {0xED63A231D4C4FB27,   162,   68},
+        {0xB0DE65388CC8ADA8,   189,   76},
+        {0x83C7088E1AAB65DB,   216,   84},
+        {0xC45D1DF942711D9A,   242,   92},
+        {0x924D692CA61BE758,   269,  100},
+        {0xDA01EE641A708DEA,   295,  108},
+        {0xA26DA3999AEF774A,   322,  116},
+        {0xF209787BB47D6B85,   348,  124},
+        {0xB454E4A179DD1877,   375,  132},
+        {0x865B86925B9BC5C2,   402,  140},
+        {0xC83553C5C8965D3D,   428,  148},
+        {0x952AB45CFA97A0B3,   455,  156},
+        {0xDE469FBD99A05FE3,   481,  164},
+        {0xA59BC234DB398C25,   508,  172},
+        {0xF6C69A72A3989F5C,   534,  180},
+        {0xB7DCBF5354E9BECE,   561,  188},
+        {0x88FCF317F22241E2,   588,  196},
+        {0xCC20CE9BD35C78A5,   614,  204},
+        {0x98165AF37B2153DF,   641,  212},
+        {0xE2A0B5DC971F303A,   667,  220},
+        {0xA8D9D1535CE3B396,   694,  228},
+        {0xFB9B7CD9A4A7443C,   720,  236},
+        {0xBB764C4CA7A44410,   747,  244},
+        {0x8BAB8EEFB6409C1A,   774,  252},
+        {0xD01FEF10A657842C,   800,  260},
+        {0x9B10A4E5E9913129,   827,  268},
+        {0xE7109BFBA19C0C9D,   853,  276},
+        {0xAC2820D9623BF429,   880,  284},
+        {0x80444B5E7AA7CF85,   907,  292},
+        {0xBF21E44003ACDD2D,   933,  300},
+        {0x8E679C2F5E44FF8F,   960,  308},
+        {0xD433179D9C8CB841,   986,  316},
+        {0x9E19DB92B4E31BA9,  1013,  324},
+    };
+
+    static constexpr double Pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    };
+
+    template <typename F, typename BITS>
+    static bool signBit(F value) {
+        BITS bits;
+        memcpy(&bits, &value, sizeof(F));
+        return bits >> (sizeof(F) * 8 - 1);
+    }
+
+    // writes nan or inf and returns length, 0 if value is finite
+    template <typename F>
+    static int nonFinite(char * dst, F value) {
+        char const * str = 
+            (value != value) ? "nan" : 
+            (value - value == value - value) ? nullptr : 
+            (value < 0) ? "-inf" : "inf";
+        if (!str) return 0;
+        int size = (int)strlen(str);
+        memcpy(dst, str, size + 1);
+        return size;
+    }
+
+    template <typename F, typename BITS>
+    static int shortestImpl(char * dst, F value) {
+        char * p = dst;
+        if (int ret = nonFinite(p, value)) return ret;
+        if (signBit<F, BITS>(value)) {
+            *p++ = '-';
+            value = -value;
+        }
+        if (value == 0) {
+            memcpy(p, "0.0", 4);
+            return (int)(p - dst) + 3;
+        }
+
+        char digits[18];
+        int exponent;
+        int length = shortestDigits<F, BITS>(digits, exponent, value);
+
+        // value is 0.digits * 10^point
+        int point = length + exponent;
+        if (point > -4 && point <= 16) {
+            if (point >= length) {
+                memcpy(p, digits, length);
+                p += length;
+                for (int i = length; i < point; ++i) *p++ = '0';
+                *p++ = '.';
+                *p++ = '0';
+            }
+            else if (point > 0) {
+                memcpy(p, digits, point);
+                p += point;
+                *p++ = '.';
+                memcpy(p, digits + point, length - point);
+                p += length - point;
+            }
+            else {
+                *p++ = '0';
+                *p++ = '.';
+                for (int i = point; i < 0; ++i) *p++ = '0';
+                memcpy(p, digits, length);
+                p += length;
+            }
+        }
+        else {
+            *p++ = digits[0];
+            if (length > 1) {
+                *p++ = '.';
+                memcpy(p, digits + 1, length - 1);
+                p += length - 1;
+            }
+            *p++ = 'e';
+            int e = point - 1;
+            *p++ = (e < 0) ? '-' : '+';
+            p += writeUint(p, (e < 0) ? -e : e);
+        }
+        *p = '\0';
+        return (int)(p - dst);
+    }
+
+    // writes the shortest digits of positive finite value, which is then
+    // digits * 10^exponent. returns number of digits.
+    template <typename F, typename BITS>
+    static int shortestDigits(char * digits, int & exponent, F value) {
+        // boundaries of value: halfway to its neighbours
+        constexpr int Precision = (sizeof(F) == 8) ? 53 : 24;
+        constexpr int Bias = ((sizeof(F) == 8) ? 1023 : 127) + Precision - 1;
+        constexpr uint64_t HiddenBit = (uint64_t)1 << (Precision - 1);
+        BITS bits;
+        memcpy(&bits, &value, sizeof(F));
+        uint64_t biasedExponent = bits >> (Precision - 1);
+        uint64_t fraction = bits & (HiddenBit - 1);
+        DiyFp v = (biasedExponent == 0) ? 
+            DiyFp{fraction, 1 - Bias} : 
+            DiyFp{fraction + HiddenBit, (int)biasedExponent - Bias};
+        bool lowerIsCloser = (fraction == 0 && biasedExponent > 1);
+        DiyFp plus = normalize({2 * v.f + 1, v.e - 1});
+        DiyFp minus = lowerIsCloser ? DiyFp{4 * v.f - 1, v.e - 2} : DiyFp{2 * v.f - 1, v.e - 1};
+        minus = {minus.f << (minus.e - plus.e), plus.e};
+        DiyFp w = normalize(v);
+
+        // scale by a cached power of ten so plus.e is within [-60, -32]
+        int f = -60 - plus.e - 1;
+        int k = (f * 78913) / (1 << 18) + (f > 0);
+        CachedPower const & cached = CachedPowers[(300 + k + 7) / 8];
+        DiyFp c{cached.f, cached.e};
+        w = multiply(w, c);
+        minus = multiply(minus, c);
+        plus = multiply(plus, c);
+        // allow for rounding errors of the multiplication
+        minus.f += 1;
+        plus.f -= 1;
+        exponent = -cached.k;
+        return generateDigits(digits, exponent, minus, w, plus);
+    }
+
+    static int generateDigits(char * digits, int & exponent, DiyFp minus, DiyFp w, DiyFp plus) {
+        uint64_t delta = plus.f - minus.f;
+        uint64_t dist = plus.f - w.f;
+        DiyFp one{(uint64_t)1 << -plus.e, plus.e};
+        uint32_t p1 = (uint32_t)(plus.f >> -one.e);
+        uint64_t p2 = plus.f & (one.f - 1);
+        int length = 0;
+
+        // integral digits
+        uint32_t pow10 = 1;
+        int n = 1;
+        while (n < 10 && p1 >= pow10 * (uint64_t)10) {
+            pow10 *= 10;
+            ++n;
+        }
+        while (n > 0) {
+            digits[length++] = (char)('0' + p1 / pow10);
+            p1 %= pow10;
+            --n;
+            uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+            if (rest <= delta) {
+                exponent += n;
+                roundDigits(digits, length, dist, delta, rest, (uint64_t)pow10 << -one.e);
+                return length;
+            }
+            pow10 /= 10;
+        }
+
+        // fractional digits
+        int m = 0;
+        for (;;) {
+            p2 *= 10;
+            digits[length++] = (char)('0' + (p2 >> -one.e));
+            p2 &= one.f - 1;
+            ++m;
+            delta *= 10;
+            dist *= 10;
+            if (p2 <= delta) break;
+        }
+        exponent -= m;
+        roundDigits(digits, length, dist, delta, p2, one.f);
+        return length;
+    }
+
+    // move the last digit closer to w while staying within the boundaries
+    static void roundDigits(char * digits, int length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK) {
+        while (rest < dist && delta - rest >= tenK && 
+            (rest + tenK < dist || dist - rest > rest + tenK - dist)) {
+            --digits[length - 1];
+            rest += tenK;
+        }
+    }
+
+    static DiyFp normalize(DiyFp x) {
+        while (!(x.f >> 63)) {
+            x.f <<= 1;
+            --x.e;
+        }
+        return x;
+    }
+
+    // upper 64 bits of the 128 bit product, rounded
+    static DiyFp multiply(DiyFp x, DiyFp y) {
+        uint64_t xLo = x.f & 0xffffffff, xHi = x.f >> 32;
+        uint64_t yLo = y.f & 0xffffffff, yHi = y.f >> 32;
+        uint64_t p0 = xLo * yLo;
+        uint64_t p1 = xLo * yHi;
+        uint64_t p2 = xHi * yLo;
+        uint64_t p3 = xHi * yHi;
+        uint64_t q = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff) + ((uint64_t)1 << 31);
+        return {p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64};
+    }
+
+    static int writeUint(char * dst, uint64_t value) {
+        char tmp[20];
+        int size = 0;
+        do {
+            tmp[size++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        for (int i = 0; i < size; ++i) dst[i] = tmp[size - 1 - i];
+        return size;
+    }
+#endif
+
+// Native formatting
+// Used by all calls if CHAR_STREAM_ENABLE_NATIVE_FORMAT is defined,
+// otherwise only by calls with a writeTo parameter.
+public:
+
+    // Write cursor into the target, passed to the writeTo function of
+    // custom parameter types. Shared by all sinks.
+    using Writer = CharStreamWriter;
+
+    // Pointer and count parameter, written like a std::vector
+    template <typename T>
+    struct Span {
+        T const * ptr;
+        size_t count;
+        Span(T const * ptr, size_t count) : ptr(ptr), count(count) {}
+        T const * data() const { return ptr; }
+        size_t size() const { return count; }
+    };
+
+private:
+
+    // Types with a writeTo(CharStream::Writer &) const member
+    template <typename T, typename = void>
+    struct IsWritable : std::false_type {};
+    template <typename T>
+    struct IsWritable<T, std::void_t<decltype(std::declval<T const &>().writeTo(std::declval<Writer &>()))>> : std::true_type {};
+
+    // Strings with a known size: std::string_view, and types that
+    // convert to one but not to char const * (std::string)
+    template <typename T>
+    struct IsSizedString : std::bool_constant<
+        std::is_convertible_v<T, std::string_view> && 
+        !std::is_convertible_v<T, char const *>> {};
+
+    // Char arrays, which are written up to the first null-byte without
+    // reading past their end
+    template <typename T>
+    struct IsCharArray : std::bool_constant<
+        std::is_array_v<std::remove_reference_t<T>> && 
+        std::is_same_v<std::remove_cv_t<std::remove_extent_t<std::remove_reference_t<T>>>, char>> {};
+
+    // Element type of arrays and of types with data() and size()
+    // members (std::vector, std::array, std::span, Span), else void
+    template <typename T, typename = void>
+    struct RangeElement { using type = void; };
+    template <typename T, size_t N>
+    struct RangeElement<T[N]> { using type = std::remove_cv_t<T>; };
+    template <typename T>
+    struct RangeElement<T, std::void_t<decltype(std::declval<T const &>().data()), decltype(std::declval<T const &>().size())>> {
+        using type = std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<T const &>().data())>>;
+    };
+
+    // Ranges of numbers, written separated by the call's separator
+    template <typename T, typename E = typename RangeElement<std::remove_cv_t<std::remove_reference_t<T>>>::type>
+    struct IsNumberRange : std::bool_constant<std::is_arithmetic_v<E> && !std::is_same_v<E, char>> {};
+
+    template <typename ... TS>
+    static constexpr bool writeNatively() {
+        #ifdef CHAR_STREAM_ENABLE_NATIVE_FORMAT
+        return true;
+        #else
+        return ((IsWritable<TS>::value || IsSizedString<TS>::value || IsNumberRange<TS>::value) || ...);
+        #endif
+    }
+
+    // Make room for size more bytes in w, by writing out or growing the
+    // target. Returns false if there still isn't room.
+    bool writerFlush(Writer & w, size_t size) {
+        // truncated, or a target without storage
+        if (w._full || w._end == _buff) return false;
+        if (streamed()) {
+            writerDirect(w._begin, w._cur - w._begin);
+            w._flushed += w._cur - w._mark;
+            w._mark = w._cur = w._begin;
+        }
+        else if constexpr (IsWindowSink<SINK>::value) {
+            // written bytes stay in the sink, continue in its next window
+            _sink.commit(w._cur);
+            w._flushed += w._cur - w._mark;
+            char * end;
+            char * cur = _sink.reserve(size, end);
+            if (!cur) {
+                w._begin = w._mark = w._cur = w._end = _buff;
+                return false;
+            }
+            w._begin = w._mark = w._cur = cur;
+            w._end = end;
+        }
+        else if (_target.kind == Target::Growable) {
+            GrowableBuffer & g = *_target.growable;
+            size_t mark = w._mark - g.str;
+            size_t cur = w._cur - g.str;
+            if (!g.reserve(cur + size + 1, cur)) return false;
+            w._begin = w._mark = g.str + mark;
+            w._cur = g.str + cur;
+            w._end = g.str + g.capacity - 1;
+        }
+        #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+        else if (_target.kind == Target::Mapped) {
+            // written bytes stay behind in the file, continue in the next
+            // window
+            MappedFile & m = *_target.mapped;
+            m.size = w._cur - m.str;
+            w._flushed += w._cur - w._mark;
+            if (!m.reserve(size + 1)) {
+                // old window is gone, write nothing more (to _buff)
+                w._begin = w._mark = w._cur = w._end = _buff;
+                return false;
+            }
+            w._begin = w._mark = w._cur = m.str + m.size;
+            w._end = m.str + m.capacity - 1;
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+        else if (_target.kind == Target::Rotating) {
+            // this call's output so far moves to the next segment with it
+            RotatingFile & r = *_target.rotating;
+            size_t keep = w._cur - w._mark;
+            r.size = w._mark - r.str;
+            if (!r.reserve(size + 1, keep)) return false;
+            w._begin = w._mark = r.str + r.size;
+            w._cur = w._mark + keep;
+            w._end = r.str + r.capacity - 1;
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_URING
+        else if (_target.kind == Target::Uring) {
+            // written bytes are on their way, continue in the next buffer
+            UringFile & u = *_target.uring;
+            u.size = w._cur - u.str;
+            w._flushed += w._cur - w._mark;
+            u.reserve(size + 1);
+            w._begin = w._mark = w._cur = u.str + u.size;
+            w._end = u.str + u.capacity - 1;
+        }
+        #endif
+        return w.fits(size);
+    }
+
+    // Write straight to the target, bypassing w. Only possible for
+    // standard outputs.
+    bool writerDirect(char const * str, size_t size) {
+        if (!streamed()) return false;
+        if (size) syswrite(str, size);
+        return true;
+    }
+
+    Writer targetWriter() {
+        #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+        if (streamed() && _flushSize) {
+            return Writer{this, _outBuff, _outBuff + _outSize, _outBuff + CHAR_STREAM_OUTPUT_BUFFER_SIZE};
+        }
+        #endif
+        if (streamed()) {
+            return Writer{this, _buff, _buff, _buff + CHAR_STREAM_BUFFER_SIZE};
+        }
+        if constexpr (IsWindowSink<SINK>::value) {
+            char * end;
+            char * cur = _sink.reserve(0, end);
+            if (!cur) return Writer{this, _buff, _buff, _buff};
+            return Writer{this, cur, cur, end};
+        }
+        if (_target.kind == Target::Buffer) {
+            StringBuffer & b = *_target.buffer;
+            return Writer{this, b.str + b.size, b.str + b.size, b.str + b.capacity - 1};
+        }
+        if (_target.kind == Target::Growable) {
+            // without any storage, write nothing (to _buff)
+            GrowableBuffer & g = *_target.growable;
+            if (!g.reserve(g.size + 1)) return Writer{this, _buff, _buff, _buff};
+            return Writer{this, g.str + g.size, g.str + g.size, g.str + g.capacity - 1};
+        }
+        #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+        if (_target.kind == Target::Mapped) {
+            MappedFile & m = *_target.mapped;
+            if (!m.reserve(1)) return Writer{this, _buff, _buff, _buff};
+            return Writer{this, m.str + m.size, m.str + m.size, m.str + m.capacity - 1};
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+        if (_target.kind == Target::Rotating) {
+            RotatingFile & r = *_target.rotating;
+            if (!r.reserve(1)) return Writer{this, _buff, _buff, _buff};
+            return Writer{this, r.str + r.size, r.str + r.size, r.str + r.capacity - 1};
+        }
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_URING
+        if (_target.kind == Target::Uring) {
+            UringFile & u = *_target.uring;
+            if (!u.reserve(1)) return Writer{this, _buff, _buff, _buff};
+            return Writer{this, u.str + u.size, u.str + u.size, u.str + u.capacity - 1};
+        }
+        #endif
+        return Writer{this, _target.str, _target.str, nullptr};
+    }
+
+    int targetFinish(Writer & w) {
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        if (w._full) count<&Stats::truncations>(1);
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+        if (streamed() && _flushSize) {
+            _outSize = w._cur - _outBuff;
+            if (_outSize >= _flushSize) flush();
+            return w.size();
+        }
+        #endif
+        if (streamed()) {
+            writerDirect(w._begin, w._cur - w._begin);
+        }
+        else if (w._begin == _buff) {
+            // target without storage
+        }
+        else if constexpr (IsWindowSink<SINK>::value) {
+            *w._cur = '\0';
+            _sink.commit(w._cur);
+        }
+        else {
+            *w._cur = '\0';
+            if (_target.kind == Target::Buffer) _target.buffer->size = w._cur - _target.buffer->str;
+            if (_target.kind == Target::Growable) _target.growable->size = w._cur - _target.growable->str;
+            #ifdef CHAR_STREAM_ENABLE_MAPPED_FILE
+            if (_target.kind == Target::Mapped) _target.mapped->size = w._cur - _target.mapped->str;
+            #endif
+            #ifdef CHAR_STREAM_ENABLE_ROTATING_FILE
+            if (_target.kind == Target::Rotating) _target.rotating->size = w._cur - _target.rotating->str;
+            #endif
+            #ifdef CHAR_STREAM_ENABLE_URING
+            if (_target.kind == Target::Uring) _target.uring->size = w._cur - _target.uring->str;
+            #endif
+        }
+        return w.size();
+    }
+
+    template <typename ... TS>
+    int nativeWrite(
+        char const * sep, 
+        char const * trm, 
+        size_t paramCount, 
+        TS && ... params) {
+
+        #ifdef CHAR_STREAM_ENABLE_STATS
+        StatsTimer<&Stats::formatCycles> timer{this};
+        #endif
+        Writer w = targetWriter();
+        w._sep = sep;
+        size_t paramIndex = 0;
+        (nativeWriteItem(w, sep, trm, paramIndex, paramCount, static_cast<TS &&>(params)), ...);
+        return counted(targetFinish(w));
+    }
+
+    #ifdef CHAR_STREAM_ENABLE_TEE
+    // output formatted by another stream (CharStreamTee)
+    void writeRaw(char const * str, size_t size) {
+        Writer w = targetWriter();
+        w.write(str, size);
+        targetFinish(w);
+    }
+    #endif
+
+    template <typename TS>
+    void nativeWriteItem(
+        Writer & w,
+        char const * sep, 
+        char const * trm, 
+        size_t & paramIndex,
+        size_t paramCount,
+        TS && param) {
+
+        writeValue(w, static_cast<TS &&>(param));
+
+        // same rules as writeFormatItem
+        if      (paramIndex <  paramCount-1) w.write(sep);
+        else if (paramIndex == paramCount-1) w.write(trm);
+
+        ++paramIndex;
+    }
+
+    template <typename T>
+    static void writeValue(Writer & w, T && value) {
+        if constexpr (IsWritable<T>::value) {
+            value.writeTo(w);
+        }
+        else if constexpr (IsSizedString<T>::value) {
+            std::string_view str = value;
+            w.write(str.data(), str.size());
+        }
+        else if constexpr (IsCharArray<T>::value) {
+            constexpr size_t N = std::extent_v<std::remove_reference_t<T>>;
+            char const * end = (char const *)memchr(value, '\0', N);
+            w.write(value, end ? end - value : N);
+        }
+        else if constexpr (IsNumberRange<T>::value) {
+            if constexpr (std::is_array_v<std::remove_reference_t<T>>) {
+                writeRange(w, value, std::extent_v<std::remove_reference_t<T>>);
+            }
+            else {
+                writeRange(w, value.data(), (size_t)value.size());
+            }
+        }
+        else {
+            emit(w, coerceToExpectedParam(static_cast<T &&>(value)));
+        }
+    }
+
+    static void emit(Writer & w, char const * str) {
+        w.write(str);
+    }
+
+    static void emit(Writer & w, char c) {
+        w.write(c);
+    }
+
+    // Without CHAR_STREAM_ENABLE_NATIVE_FORMAT, calls are only formatted
+    // natively for some of their parameters (see writeNatively), so the
+    // others are written the same as by CHAR_STREAM_SPRINTF: floats with
+    // "%f", and integers as sprintfInt.
+    #if defined(CHAR_STREAM_ENABLE_SHORTEST_FLOAT) && defined(CHAR_STREAM_ENABLE_NATIVE_FORMAT)
+    static void emit(Writer & w, float value) {
+        char tmp[32];
+        w.write(tmp, shortest(tmp, value));
+    }
+
+    static void emit(Writer & w, double value) {
+        char tmp[32];
+        w.write(tmp, shortest(tmp, value));
+    }
+    #else
+    static void emit(Writer & w, float value) {
+        emit(w, (double)value);
+    }
+
+    static void emit(Writer & w, double value) {
+        // large enough for "%f" of DBL_MAX
+        char tmp[320];
+        int size = CHAR_STREAM_SPRINTF(tmp, "%f", value);
+        w.write(tmp, size);
+    }
+    #endif
+
+    // any remaining coerced type is an integer
+    template <typename T>
+    static void emit(Writer & w, T value) {
+        auto v = sprintfInt(value);
+        uint64_t u = (uint64_t)v;
+        if constexpr (std::is_signed_v<decltype(v)>) {
+            if (v < 0) {
+                w.write('-');
+                u = 0 - u;
+            }
+        }
+        emitUint(w, u);
+    }
+
+    // value as "%d"/"%ld" write it: unsigned types as wide as int are
+    // signed. Unchanged with CHAR_STREAM_ENABLE_NATIVE_FORMAT.
+    template <typename T>
+    static auto sprintfInt(T value) {
+        #ifndef CHAR_STREAM_ENABLE_NATIVE_FORMAT
+        if constexpr (std::is_unsigned_v<T> && sizeof(T) >= sizeof(int)) {
+            return (std::make_signed_t<T>)value;
+        }
+        else
+        #endif
+        return value;
+    }
+
+    static void emitUint(Writer & w, uint64_t value) {
+        uint8_t count = digitCount(value);
+        char tmp[20];
+        char * dst = w.reserve(count);
+        if (!dst) dst = tmp;
+        uintDigits(dst, value, count);
+        if (dst == tmp) w.write(tmp, count);
+        else w._cur += count;
+    }
+
+    // writes the count (from digitCount) decimal digits of value
+    static void uintDigits(char * dst, uint64_t value, uint8_t count) {
+        dst += count;
+        while (value >= 100) {
+            char const * pair = DigitPairs + (value % 100) * 2;
+            value /= 100;
+            *--dst = pair[1];
+            *--dst = pair[0];
+        }
+        if (value >= 10) {
+            char const * pair = DigitPairs + value * 2;
+            *--dst = pair[1];
+            *--dst = pair[0];
+        }
+        else {
+            *--dst = (char)('0' + value);
+        }
+    }
+
+    // Elements separated by w's separator. Integers are converted
+    // straight into the output in batches, with one room check per batch
+    // rather than per element.
+    template <typename T>
+    static void writeRange(Writer & w, T const * data, size_t count) {
+        size_t sepSize = strlen(w._sep);
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            // longest possible element, with separator
+            using E = decltype(sprintfInt(T()));
+            size_t maxSize = 20 + std::is_signed_v<E> + sepSize;
+            size_t batch = (CHAR_STREAM_BUFFER_SIZE > maxSize) ? CHAR_STREAM_BUFFER_SIZE / maxSize : 1;
+            size_t i = 0;
+            while (i < count) {
+                if (w._full) return;
+                size_t n = (count - i < batch) ? count - i : batch;
+                char * dst = w.reserve(n * maxSize);
+                if (!dst) {
+                    // not enough room for a batch, one at a time
+                    if (i) w.write(w._sep, sepSize);
+                    emit(w, data[i++]);
+                    continue;
+                }
+                for (size_t end = i + n; i < end; ++i) {
+                    if (i) {
+                        memcpy(dst, w._sep, sepSize);
+                        dst += sepSize;
+                    }
+                    E v = sprintfInt(data[i]);
+                    uint64_t u = (uint64_t)v;
+                    if constexpr (std::is_signed_v<E>) {
+                        if (v < 0) {
+                            *dst++ = '-';
+                            u = 0 - u;
+                        }
+                    }
+                    uint8_t digits = digitCount(u);
+                    uintDigits(dst, u, digits);
+                    dst += digits;
+                }
+                w._cur = dst;
+            }
+        }
+        else {
+            for (size_t i = 0; i < count; ++i) {
+                if (w._full) return;
+                if (i) w.write(w._sep, sepSize);
+                emit(w, coerceToExpectedParam(data[i]));
+            }
+        }
+    }
+
+    static uint8_t digitCount(uint64_t value) {
+        uint8_t count = 1;
+        for (;;) {
+            if (value < 10) return count;
+            if (value < 100) return count + 1;
+            if (value < 1000) return count + 2;
+            if (value < 10000) return count + 3;
+            value /= 10000;
+            count += 4;
+        }
+    }
+
+    static constexpr char DigitPairs[] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
+#ifdef CHAR_STREAM_ENABLE_HEX_DUMP
+// Byte dumps
+public:
+
+    // Bytes as contiguous lowercase hex digits
+    struct Hex {
+        void const * data;
+        size_t size;
+        void writeTo(Writer & w) const { writeHex(w, (uint8_t const *)data, size); }
+    };
+
+    // Bytes in lines of 16 like hexdump -C: offset, hex, then printable
+    // ASCII. Lines are separated by newlines, with none after the last.
+    struct HexDump {
+        void const * data;
+        size_t size;
+        void writeTo(Writer & w) const { writeHexDump(w, (uint8_t const *)data, size); }
+    };
+
+    // Bytes as standard base64 with padding
+    struct Base64 {
+        void const * data;
+        size_t size;
+        void writeTo(Writer & w) const { writeBase64(w, (uint8_t const *)data, size); }
+    };
+
+private:
+
+    static constexpr char HexDigits[] = "0123456789abcdef";
+
+    // 16 bytes to 32 hex digits
+    static void hex16(char * dst, uint8_t const * src) {
+        #if defined(__SSE2__) || defined(_M_X64)
+        // nibble + '0', + ('a' - '0' - 10) where nibble > 9
+        __m128i const mask = _mm_set1_epi8(0x0f);
+        __m128i const nine = _mm_set1_epi8(9);
+        __m128i const zero = _mm_set1_epi8('0');
+        __m128i const letter = _mm_set1_epi8('a' - '0' - 10);
+        __m128i v = _mm_loadu_si128((__m128i const *)src);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint8x16_t const lut = vld1q_u8((uint8_t const *)HexDigits);
+        uint8x16_t v = vld1q_u8(src);
+        uint8x16x2_t out;
+        out.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(v, 4));
+        out.val[1] = vqtbl1q_u8(lut, vandq_u8(v, vdupq_n_u8(0x0f)));
+        vst2q_u8((uint8_t *)dst, out);
+        #else
+        for (int i = 0; i < 16; ++i) {
+            dst[i * 2] = HexDigits[src[i] >> 4];
+            dst[i * 2 + 1] = HexDigits[src[i] & 0x0f];
+        }
+        #endif
+    }
+
+    static void writeHex(Writer & w, uint8_t const * data, size_t size) {
+        // converted straight into the output, 64 bytes at a time
+        while (size >= 16) {
+            if (w._full) return;
+            size_t count = (size < 64) ? size / 16 : 4;
+            char * dst = w.reserve(count * 32);
+            if (dst) {
+                for (size_t i = 0; i < count; ++i) hex16(dst + i * 32, data + i * 16);
+                w._cur += count * 32;
+            }
+            else {
+                // no room for all of it, write as much as fits
+                count = 1;
+                char tmp[32];
+                hex16(tmp, data);
+                w.write(tmp, 32);
+            }
+            data += count * 16;
+            size -= count * 16;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            char pair[2] = {HexDigits[data[i] >> 4], HexDigits[data[i] & 0x0f]};
+            w.write(pair, 2);
+        }
+    }
+
+    static void writeHexDump(Writer & w, uint8_t const * data, size_t size) {
+        // "00000000  00 01 02 03 04 05 06 07  08 09 0a 0b 0c 0d 0e 0f  |0123456789abcdef|"
+        constexpr size_t LineSize = 78;
+        for (size_t offset = 0; offset < size; offset += 16) {
+            char line[LineSize + 1];
+            size_t count = (size - offset < 16) ? size - offset : 16;
+            uint8_t const * src = data + offset;
+            for (int i = 0; i < 8; ++i) line[i] = HexDigits[(offset >> (28 - i * 4)) & 0x0f];
+            memset(line + 8, ' ', LineSize - 8);
+            char digits[32];
+            if (count == 16) {
+                hex16(digits, src);
+            }
+            else {
+                for (size_t i = 0; i < count; ++i) {
+                    digits[i * 2] = HexDigits[src[i] >> 4];
+                    digits[i * 2 + 1] = HexDigits[src[i] & 0x0f];
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                char * dst = line + 10 + i * 3 + (i >= 8);
+                dst[0] = digits[i * 2];
+                dst[1] = digits[i * 2 + 1];
+            }
+            char * ascii = line + 60;
+            *ascii++ = '|';
+            for (size_t i = 0; i < count; ++i) *ascii++ = (src[i] >= 0x20 && src[i] < 0x7f) ? (char)src[i] : '.';
+            *ascii++ = '|';
+            if (offset + 16 < size) *ascii++ = '\n';
+            w.write(line, ascii - line);
+        }
+    }
+
+    static void writeBase64(Writer & w, uint8_t const * data, size_t size) {
+        static constexpr char Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        char out[64];
+        size_t n = 0;
+        for (; size >= 3; data += 3, size -= 3) {
+            uint32_t v = (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+            out[n++] = Digits[v >> 18];
+            out[n++] = Digits[(v >> 12) & 0x3f];
+            out[n++] = Digits[(v >> 6) & 0x3f];
+            out[n++] = Digits[v & 0x3f];
+            if (n == sizeof(out)) {
+                w.write(out, n);
+                n = 0;
+            }
+        }
+        if (size) {
+            uint32_t v = (uint32_t)data[0] << 16 | ((size > 1) ? (uint32_t)data[1] << 8 : 0);
+            out[n++] = Digits[v >> 18];
+            out[n++] = Digits[(v >> 12) & 0x3f];
+            out[n++] = (size > 1) ? Digits[(v >> 6) & 0x3f] : '=';
+            out[n++] = '=';
+        }
+        w.write(out, n);
+    }
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_PARALLEL
+// Parallel ranges
+public:
+
+    // Number range parameter written like Span, but split into chunks of
+    // CHAR_STREAM_PARALLEL_CHUNK_SIZE elements that are formatted by
+    // threads (default one per hardware thread) into their own buffers,
+    // then written to the target in order. For ranges of millions of
+    // numbers; smaller ones are written on the calling thread.
+    template <typename T>
+    struct Parallel {
+        T const * ptr;
+        size_t count;
+        unsigned threads;
+        Parallel(T const * ptr, size_t count, unsigned threads = 0) : ptr(ptr), count(count), threads(threads) {}
+        template <typename C>
+        Parallel(C const & range, unsigned threads = 0) : Parallel(range.data(), (size_t)range.size(), threads) {}
+        void writeTo(Writer & w) const { writeParallel(w, ptr, count, threads); }
+    };
+    template <typename C>
+    Parallel(C const &, unsigned = 0) -> Parallel<std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<C const &>().data())>>>;
+
+private:
+
+    // GrowableBuffer::Grow on the heap, for chunk buffers
+    static char * heapGrow(void *, char * str, size_t, size_t, size_t newCapacity) {
+        return (char *)realloc(str, newCapacity);
+    }
+
+    template <typename T>
+    static void writeParallel(Writer & w, T const * data, size_t count, unsigned threads) {
+        constexpr size_t ChunkSize = CHAR_STREAM_PARALLEL_CHUNK_SIZE;
+        size_t chunkCount = (count + ChunkSize - 1) / ChunkSize;
+        if (!threads) threads = std::thread::hardware_concurrency();
+        if (threads > chunkCount) threads = (unsigned)chunkCount;
+        if (threads < 2) {
+            writeRange(w, data, count);
+            return;
+        }
+
+        // chunks are written to CharStream's growable buffer target
+        using Stream = BasicCharStream<>;
+        struct Chunk {
+            typename Stream::GrowableBuffer buffer{nullptr, heapGrow};
+            std::atomic<bool> done{false};
+        };
+        std::unique_ptr<Chunk[]> chunks(new Chunk[chunkCount]);
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> written{0};
+        // chunks formatted ahead of the one being written, bounds memory
+        size_t ahead = threads * 2;
+        char const * sep = w._sep;
+
+        auto work = [&] {
+            for (;;) {
+                size_t i = next.fetch_add(1, std::memory_order_relaxed);
+                if (i >= chunkCount) return;
+                while (i >= written.load(std::memory_order_acquire) + ahead) std::this_thread::yield();
+                size_t begin = i * ChunkSize;
+                size_t n = (count - begin < ChunkSize) ? count - begin : ChunkSize;
+                Stream stream(chunks[i].buffer);
+                Writer cw = stream.targetWriter();
+                cw._sep = sep;
+                writeRange(cw, data + begin, n);
+                stream.targetFinish(cw);
+                chunks[i].done.store(true, std::memory_order_release);
+            }
+        };
+        std::unique_ptr<std::thread[]> pool(new std::thread[threads]);
+        for (unsigned t = 0; t < threads; ++t) pool[t] = std::thread(work);
+
+        // the calling thread writes chunks out as they complete
+        for (size_t i = 0; i < chunkCount; ++i) {
+            while (!chunks[i].done.load(std::memory_order_acquire)) std::this_thread::yield();
+            auto & b = chunks[i].buffer;
+            if (i) w.write(sep);
+            w.write(b.str, b.size);
+            free(b.str);
+            b.release();
+            written.store(i + 1, std::memory_order_release);
+        }
+        for (unsigned t = 0; t < threads; ++t) pool[t].join();
+    }
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_CHECKED_FORMAT
+// Checked format strings
+public:
+
+    // Format
+    // Like format(char const *, ...), but the format string is parsed at
+    // compile time and checked against the parameter types, so that a
+    // mismatch fails to compile. Plain %d/%i/%u, and %s and %c with any
+    // width, are written with the native formatters, everything else
+    // with one CHAR_STREAM_SPRINTF per conversion. Output is the same as
+    // format(char const *, ...).
+    template <typename FMT, typename ... TS, typename = decltype(FMT::str())>
+    int format(FMT, TS && ... params) {
+        constexpr ParsedFormat<FMT> const & parsed = parsedFormat<FMT>;
+        static_assert(parsed.valid, 
+            "CHAR_STREAM_FMT: unsupported conversion, or width/precision over 255");
+        static_assert(parsed.Count == sizeof...(TS), 
+            "CHAR_STREAM_FMT: parameter count doesn't match the format string");
+        if constexpr (parsed.valid && parsed.Count == sizeof...(TS)) {
+            static_assert(formatAccepts<FMT, TS...>(std::index_sequence_for<TS...>{}), 
+                "CHAR_STREAM_FMT: parameter type doesn't match its conversion");
+            #ifdef CHAR_STREAM_ENABLE_STATS
+            StatsTimer<&Stats::formatCycles> timer{this};
+            #endif
+            Writer w = targetWriter();
+            formatWrite<FMT>(w, std::index_sequence_for<TS...>{}, static_cast<TS &&>(params)...);
+            return counted(targetFinish(w));
+        }
+        return 0;
+    }
+
+private:
+
+    // One conversion, and the literal text before it
+    struct FormatSpec {
+        size_t text = 0;       // offset of the literal in ParsedFormat::text
+        size_t textSize = 0;
+        size_t spec = 0;       // offset of "%...x" in ParsedFormat::specs
+        char conversion = '\0';
+        char length = '\0';    // h, H (hh), l, L (ll), j, z, t or q (L)
+        bool left = false;
+        bool flags = false;    // any of + space # 0
+        int width = -1;
+        int precision = -1;
+
+        constexpr bool plain() const { return !left && !flags && width < 0 && precision < 0; }
+    };
+
+    static constexpr size_t countConversions(char const * fmt) {
+        size_t count = 0;
+        for (size_t i = 0; fmt[i]; ++i) {
+            if (fmt[i] != '%') continue;
+            if (fmt[i + 1] == '%') ++i;
+            else ++count;
+        }
+        return count;
+    }
+
+    // Literal text with %% collapsed, a null-terminated printf spec for
+    // each conversion, and the parsed conversions. The text after the
+    // last conversion is params[Count].
+    template <typename FMT>
+    struct ParsedFormat {
+        static constexpr size_t Size = slen(FMT::str());
+        static constexpr size_t Count = countConversions(FMT::str());
+
+        char text[Size + 1] = {};
+        char specs[Size + Count + 1] = {};
+        FormatSpec params[Count + 1] = {};
+        bool valid = true;
+
+        constexpr ParsedFormat() {
+            char const * fmt = FMT::str();
+            size_t t = 0;
+            size_t s = 0;
+            size_t n = 0;
+            size_t i = 0;
+            while (i < Size) {
+                if (fmt[i] != '%' || fmt[i + 1] == '%') {
+                    text[t++] = fmt[i];
+                    i += (fmt[i] == '%') ? 2 : 1;
+                    continue;
+                }
+                FormatSpec & p = params[n];
+                p.textSize = t - p.text;
+                p.spec = s;
+                size_t start = i++;
+                for (;; ++i) {
+                    if (fmt[i] == '-') p.left = true;
+                    else if (fmt[i] == '+' || fmt[i] == ' ' || fmt[i] == '#' || fmt[i] == '0') p.flags = true;
+                    else break;
+                }
+                if (fmt[i] >= '0' && fmt[i] <= '9') p.width = 0;
+                for (; fmt[i] >= '0' && fmt[i] <= '9'; ++i) p.width = p.width * 10 + (fmt[i] - '0');
+                if (fmt[i] == '.') {
+                    p.precision = 0;
+                    for (++i; fmt[i] >= '0' && fmt[i] <= '9'; ++i) p.precision = p.precision * 10 + (fmt[i] - '0');
+                }
+                if (fmt[i] == 'h' || fmt[i] == 'l') {
+                    p.length = fmt[i];
+                    if (fmt[i + 1] == fmt[i]) {
+                        p.length = (fmt[i] == 'h') ? 'H' : 'L';
+                        ++i;
+                    }
+                    ++i;
+                }
+                else if (fmt[i] == 'j' || fmt[i] == 'z' || fmt[i] == 't') p.length = fmt[i++];
+                else if (fmt[i] == 'L') { p.length = 'q'; ++i; }
+                p.conversion = fmt[i];
+                bool known = false;
+                for (char const * c = "diuxXocsfFeEgGaA"; *c; ++c) known |= (p.conversion == *c);
+                if (!known || p.width > 255 || p.precision > 255) {
+                    valid = false;
+                    return;
+                }
+                ++i;
+                while (start < i) specs[s++] = fmt[start++];
+                specs[s++] = '\0';
+                params[++n].text = t;
+            }
+            params[n].textSize = t - params[n].text;
+        }
+    };
+    template <typename FMT>
+    static constexpr ParsedFormat<FMT> parsedFormat{};
+
+    // Whether a T parameter can be written with conversion p
+    template <typename T>
+    static constexpr bool formatAccepts(FormatSpec const & p) {
+        bool string = IsWritable<T>::value || IsSizedString<T>::value || IsCharArray<T>::value;
+        if (p.conversion == 's') {
+            if (p.length || p.flags) return false;
+            if (IsWritable<T>::value) return p.plain();
+            if (string) return true;
+        }
+        if constexpr (!IsWritable<T>::value && !IsSizedString<T>::value && !IsCharArray<T>::value) {
+            using E = ExpectedType<T>;
+            if constexpr (std::is_same_v<E, char const *> || std::is_same_v<E, bool>) {
+                return p.conversion == 's';
+            }
+            else if constexpr (std::is_floating_point_v<E>) {
+                for (char const * c = "fFeEgGaA"; *c; ++c) {
+                    if (p.conversion == *c) return !p.length || p.length == 'l';
+                }
+            }
+            else {
+                if (p.conversion == 'c') return !p.length && !p.flags && p.precision < 0;
+                for (char const * c = "diuxXo"; *c; ++c) {
+                    if (p.conversion != *c) continue;
+                    // the modifier's type must have E's size, or E is
+                    // promoted to int
+                    size_t size = 
+                        (p.length == 'l') ? sizeof(long) : 
+                        (p.length == 'L') ? sizeof(long long) :
+                        (p.length == 'j') ? sizeof(intmax_t) :
+                        (p.length == 'z') ? sizeof(size_t) :
+                        (p.length == 't') ? sizeof(std::ptrdiff_t) :
+                        (p.length == 'q') ? 0 :
+                        sizeof(int);
+                    return (sizeof(E) == size) || (size == sizeof(int) && sizeof(E) < sizeof(int));
+                }
+            }
+        }
+        return false;
+    }
+    template <typename FMT, typename ... TS, size_t ... I>
+    static constexpr bool formatAccepts(std::index_sequence<I...>) {
+        return (true && ... && formatAccepts<TS>(parsedFormat<FMT>.params[I]));
+    }
+
+    template <typename FMT, size_t ... I, typename ... TS>
+    static void formatWrite(Writer & w, std::index_sequence<I...>, TS && ... params) {
+        (formatItem<FMT, I>(w, static_cast<TS &&>(params)), ...);
+        constexpr FormatSpec const & last = parsedFormat<FMT>.params[sizeof...(TS)];
+        w.write(parsedFormat<FMT>.text + last.text, last.textSize);
+    }
+
+    template <typename FMT, size_t I, typename T>
+    static void formatItem(Writer & w, T && value) {
+        constexpr FormatSpec const & p = parsedFormat<FMT>.params[I];
+        w.write(parsedFormat<FMT>.text + p.text, p.textSize);
+
+        if constexpr (p.conversion == 's' && p.plain()) {
+            writeValue(w, static_cast<T &&>(value));
+        }
+        else if constexpr (p.conversion == 's') {
+            std::string_view str;
+            if constexpr (IsSizedString<T>::value) {
+                str = value;
+            }
+            else if constexpr (IsCharArray<T>::value) {
+                constexpr size_t N = std::extent_v<std::remove_reference_t<T>>;
+                char const * end = (char const *)memchr(value, '\0', N);
+                str = std::string_view(value, end ? end - value : N);
+            }
+            else {
+                char const * c = coerceToExpectedParam(static_cast<T &&>(value));
+                char const * end = (p.precision < 0) ? nullptr : (char const *)memchr(c, '\0', p.precision);
+                str = std::string_view(c, (p.precision < 0) ? strlen(c) : end ? end - c : p.precision);
+            }
+            if (p.precision >= 0 && str.size() > (size_t)p.precision) str = str.substr(0, p.precision);
+            formatPadded(w, p, str.data(), str.size());
+        }
+        else if constexpr (p.conversion == 'c' && !p.flags) {
+            char c = (char)coerceToExpectedParam(static_cast<T &&>(value));
+            formatPadded(w, p, &c, 1);
+        }
+        else if constexpr ((p.conversion == 'd' || p.conversion == 'i' || p.conversion == 'u') && 
+            p.plain() && p.length != 'h' && p.length != 'H') {
+            using E = ExpectedType<T>;
+            E e = coerceToExpectedParam(static_cast<T &&>(value));
+            // the value sprintf would see after promotion
+            if constexpr (p.conversion == 'u') {
+                if constexpr (sizeof(E) < sizeof(int)) emit(w, (uint64_t)(unsigned)e);
+                else emit(w, (uint64_t)(std::make_unsigned_t<E>)e);
+            }
+            else {
+                if constexpr (sizeof(E) < sizeof(int)) emit(w, (int64_t)e);
+                else emit(w, (int64_t)(std::make_signed_t<E>)e);
+            }
+        }
+        else {
+            // large enough for a padded "%f" of DBL_MAX
+            constexpr size_t MaxSize = 320 + (p.width > 0 ? p.width : 0) + (p.precision > 0 ? p.precision : 0);
+            char tmp[MaxSize + 1];
+            int size = CHAR_STREAM_SPRINTF(tmp, parsedFormat<FMT>.specs + p.spec, coerceToExpectedParam(static_cast<T &&>(value)));
+            w.write(tmp, size);
+        }
+    }
+
+    // str padded with spaces to p.width, on the left unless p.left
+    static void formatPadded(Writer & w, FormatSpec const & p, char const * str, size_t size) {
+        if (!p.left) for (int i = (int)size; i < p.width; ++i) w.write(' ');
+        w.write(str, size);
+        if (p.left) for (int i = (int)size; i < p.width; ++i) w.write(' ');
+    }
+#endif
+
+// Instance storage
+private:
+    Target _target;
+    bool _targetIsSTD;
+    Level _level = Debug;
+    char const * _sep;
+    char const * _trm;
+    SINK _sink;
+    char _buff[CHAR_STREAM_BUFFER_SIZE];
+    char _formatBuff[CHAR_STREAM_FORMAT_BUFFER_SIZE];
+    #ifdef CHAR_STREAM_ENABLE_STATS
+    Stats _stats;
+    #endif
+    template <typename> friend class BasicCharStream;
+    friend class CharStreamWriter;
+    #ifdef CHAR_STREAM_ENABLE_ASYNC
+    friend class AsyncCharStream;
+    #endif
+    #ifdef CHAR_STREAM_ENABLE_TEE
+    template <typename ...> friend class CharStreamTee;
+    #endif
+    #ifdef CHAR_STREAM_ENABLE_BINARY
+    friend class BinaryCharStream;
+    #endif
+    #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+    static_assert(CHAR_STREAM_OUTPUT_BUFFER_SIZE >= CHAR_STREAM_BUFFER_SIZE, 
+        "CHAR_STREAM_OUTPUT_BUFFER_SIZE must be at least CHAR_STREAM_BUFFER_SIZE");
+    size_t _flushSize = 0;
+    size_t _outSize = 0;
+    uint32_t _flushLines = 0;
+    uint32_t _lines = 0;
+    char _outBuff[CHAR_STREAM_OUTPUT_BUFFER_SIZE];
+    #endif
+
+};
+
+
+using CharStream = BasicCharStream<>;
+#ifdef CHAR_STREAM_SYSWRITE
+using FdCharStream = BasicCharStream<CharStreamFdSink>;
+#endif
+using StrCharStream = BasicCharStream<CharStreamStrSink>;
+
+template <typename T>
+void CharStreamWriter::writeValue(T && value) {
+    CharStream::writeValue(*this, static_cast<T &&>(value));
+}
+
+#ifdef CHAR_STREAM_ENABLE_TEE
+// Stream sink that writes each call's output, formatted once, to several
+// streams with any sinks. Calls through a level function or macro only
+// go to streams whose instance level allows them; other calls go to all.
+template <typename ... STREAMS>
+class CharStreamTee {
+public:
+    CharStreamTee(STREAMS & ... streams) : _streams(streams...) {}
+
+    void write(char const * str, size_t size) {
+        std::apply([&](STREAMS & ... streams) { (dispatch(streams, str, size), ...); }, _streams);
+    }
+    void callLevel(CharStreamLevels::Level level) { _level = level; }
+
+private:
+    template <typename STREAM>
+    void dispatch(STREAM & stream, char const * str, size_t size) {
+        if (stream.enabled(_level)) stream.writeRaw(str, size);
+    }
+
+    std::tuple<STREAMS & ...> _streams;
+    CharStreamLevels::Level _level = CharStreamLevels::Off;
+};
+
+template <typename ... STREAMS>
+using TeeCharStream = BasicCharStream<CharStreamTee<STREAMS...>>;
+#endif
+
+#ifdef CHAR_STREAM_ENABLE_COMPRESS
+// LZ77 block codec of CharStreamCompress, in the style of LZ4. A block is
+// a series of sequences, each a token byte (literal length << 4 | match
+// length - 4, a nibble of 15 continued by bytes adding up to 255 each),
+// the literals, then a 2 byte little endian match offset. The last
+// sequence has only literals.
+// A frame is an 8 byte header, the packed size with StoredFlag if the
+// block is stored uncompressed then the raw size, both 4 byte little
+// endian, followed by the packed block.
+struct CharStreamLZ {
+    static constexpr size_t HeaderSize = 8;
+    static constexpr uint32_t StoredFlag = 0x80000000u;
+    static constexpr size_t MaxBlockSize = 1 << 24;
+
+    // Packed size of a block of size bytes in the worst case
+    static constexpr size_t bound(size_t size) { return size + size / 255 + 16; }
+
+    // Compresses size bytes of src into dst of bound(size) bytes, returns
+    // the packed size. table is scratch space of TableSize entries.
+    static constexpr size_t TableSize = 1 << 12;
+    static size_t compress(char const * src, size_t size, char * dst, uint32_t * table) {
+        memset(table, 0, TableSize * sizeof(uint32_t));
+        char * out = dst;
+        size_t anchor = 0;
+        size_t i = 0;
+        // matches start at least 8 bytes before the end, so the tail of the
+        // block is always literals
+        size_t limit = size > 12 ? size - 8 : 0;
+        while (i < limit) {
+            uint32_t seq = load32(src + i);
+            uint32_t & entry = table[hash(seq)];
+            size_t candidate = entry;
+            entry = (uint32_t)i + 1;
+            if (candidate && i + 1 - candidate <= 65535 && load32(src + candidate - 1) == seq) {
+                candidate -= 1;
+                size_t length = 4;
+                while (i + length < size && src[candidate + length] == src[i + length]) ++length;
+                out = writeSequence(out, src + anchor, i - anchor, i - candidate, length);
+                i += length;
+                anchor = i;
+            } else {
+                // step faster through data that doesn't compress
+                i += 1 + ((i - anchor) >> 6);
+            }
+        }
+        out = writeSequence(out, src + anchor, size - anchor, 0, 0);
+        return out - dst;
+    }
+
+    // Decompresses size bytes of a block from src into dst, returns the raw
+    // size or -1 if the block is invalid or larger than capacity
+    static long decompress(char const * src, size_t size, char * dst, size_t capacity) {
+        unsigned char const * in = (unsigned char const *)src;
+        unsigned char const * end = in + size;
+        size_t pos = 0;
+        while (in < end) {
+            unsigned token = *in++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(in, end, literals)) return -1;
+            if (literals > (size_t)(end - in) || literals > capacity - pos) return -1;
+            memcpy(dst + pos, in, literals);
+            in += literals;
+            pos += literals;
+            if (in == end) break;
+            if (end - in < 2) return -1;
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t length = token & 15;
+            if (length == 15 && !readLength(in, end, length)) return -1;
+            length += 4;
+            if (!offset || offset > pos || length > capacity - pos) return -1;
+            // byte by byte, the match may overlap what it copies
+            for (char const * from = dst + pos - offset, * to = from + length; from < to; ) dst[pos++] = *from++;
+        }
+        return (long)pos;
+    }
+
+    static void writeHeader(char * dst, uint32_t packed, uint32_t raw) {
+        store32(dst, packed);
+        store32(dst + 4, raw);
+    }
+    static void readHeader(char const * src, uint32_t & packed, uint32_t & raw) {
+        packed = load32(src);
+        raw = load32(src + 4);
+    }
+
+private:
+    static uint32_t load32(char const * src) {
+        unsigned char const * s = (unsigned char const *)src;
+        return s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t)s[3] << 24);
+    }
+    static void store32(char * dst, uint32_t value) {
+        for (int i = 0; i < 4; ++i) dst[i] = (char)(value >> (i * 8));
+    }
+    static uint32_t hash(uint32_t seq) { return (seq * 2654435761u) >> 20; }
+
+    static char * writeLength(char * out, size_t length) {
+        for (; length >= 255; length -= 255) *out++ = (char)255;
+        *out++ = (char)length;
+        return out;
+    }
+    static bool readLength(unsigned char const *& in, unsigned char const * end, size_t & length) {
+        unsigned byte;
+        do {
+            if (in == end) return false;
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static char * writeSequence(char * out, char const * literals, size_t literalCount, size_t offset, size_t length) {
+        size_t matchCode = length ? length - 4 : 0;
+        *out++ = (char)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+        if (literalCount >= 15) out = writeLength(out, literalCount - 15);
+        memcpy(out, literals, literalCount);
+        out += literalCount;
+        if (length) {
+            *out++ = (char)offset;
+            *out++ = (char)(offset >> 8);
+            if (matchCode >= 15) out = writeLength(out, matchCode - 15);
+        }
+        return out;
+    }
+};
+
+// Stream sink that collects output into blocks of
+// CHAR_STREAM_COMPRESS_BLOCK_SIZE bytes and writes each, compressed with
+// CharStreamLZ and framed, to OUT, another stream sink. Output is only
+// written once a block is full, on flush() and on destruction.
+template <typename OUT>
+class CharStreamCompress {
+    static_assert(CHAR_STREAM_COMPRESS_BLOCK_SIZE > 0 && CHAR_STREAM_COMPRESS_BLOCK_SIZE <= CharStreamLZ::MaxBlockSize, 
+        "CHAR_STREAM_COMPRESS_BLOCK_SIZE out of range");
+    static constexpr size_t BlockSize = CHAR_STREAM_COMPRESS_BLOCK_SIZE;
+
+public:
+    CharStreamCompress(OUT out = OUT()) : 
+        _out(std::move(out)),
+        _block((char *)malloc(BlockSize + CharStreamLZ::HeaderSize + CharStreamLZ::bound(BlockSize))),
+        _table((uint32_t *)malloc(CharStreamLZ::TableSize * sizeof(uint32_t))) {}
+    CharStreamCompress(CharStreamCompress && other) : 
+        _out(std::move(other._out)), _block(other._block), _table(other._table), _size(other._size) {
+        other._block = nullptr;
+        other._table = nullptr;
+        other._size = 0;
+    }
+    CharStreamCompress(CharStreamCompress const &) = delete;
+    CharStreamCompress & operator=(CharStreamCompress const &) = delete;
+    ~CharStreamCompress() {
+        flush();
+        free(_block);
+        free(_table);
+    }
+
+    void write(char const * str, size_t size) {
+        if (!_block || !_table) return;
+        while (size) {
+            size_t part = (size < BlockSize - _size) ? size : BlockSize - _size;
+            memcpy(_block + _size, str, part);
+            _size += part;
+            str += part;
+            size -= part;
+            if (_size == BlockSize) flush();
+        }
+    }
+
+    // Compresses and writes the pending block, if any
+    void flush() {
+        if (!_size) return;
+        char * frame = _block + BlockSize;
+        char * packed = frame + CharStreamLZ::HeaderSize;
+        size_t packedSize = CharStreamLZ::compress(_block, _size, packed, _table);
+        if (packedSize >= _size) {
+            memcpy(packed, _block, _size);
+            CharStreamLZ::writeHeader(frame, (uint32_t)_size | CharStreamLZ::StoredFlag, (uint32_t)_size);
+            packedSize = _size;
+        } else {
+            CharStreamLZ::writeHeader(frame, (uint32_t)packedSize, (uint32_t)_size);
+        }
+        _out.write(frame, CharStreamLZ::HeaderSize + packedSize);
+        _size = 0;
+    }
+
+    OUT & out() { return _out; }
+
+private:
+    OUT _out;
+    // the pending block, then room for a frame
+    char * _block;
+    uint32_t * _table;
+    size_t _size = 0;
+};
+
+template <typename OUT>
+using CompressCharStream = BasicCharStream<CharStreamCompress<OUT>>;
+#endif
+
+
+// Level macros
+// Like the level functions, but the parameters aren't evaluated at all
+// unless the level is enabled.
+#define CHAR_STREAM_LOG(LEVEL, STREAM, ...) do { \
+    using CharStreamType_ = std::remove_reference_t<decltype(STREAM)>; \
+    if constexpr (CharStreamType_::LEVEL >= CHAR_STREAM_LEVEL) { \
+        if ((STREAM).enabled(CharStreamType_::LEVEL)) (STREAM).template level<CharStreamType_::LEVEL>(__VA_ARGS__); \
+    } \
+} while (0)
+#define CHAR_STREAM_DEBUG(STREAM, ...) CHAR_STREAM_LOG(Debug, STREAM, __VA_ARGS__)
+#define CHAR_STREAM_INFO(STREAM, ...)  CHAR_STREAM_LOG(Info,  STREAM, __VA_ARGS__)
+#define CHAR_STREAM_WARN(STREAM, ...)  CHAR_STREAM_LOG(Warn,  STREAM, __VA_ARGS__)
+#define CHAR_STREAM_ERROR(STREAM, ...) CHAR_STREAM_LOG(Error, STREAM, __VA_ARGS__)
+
+
+#ifdef CHAR_STREAM_ENABLE_RATE_LIMIT
+// Per callsite state of CHAR_STREAM_RATE_LIMIT
+class CharStreamRateLimit {
+public:
+    // Whether a call may go ahead, at most perSecond in each one second
+    // window. Past the limit, costs an atomic increment and a clock read.
+    bool allow(uint64_t perSecond) {
+        uint64_t count = _count.fetch_add(1, std::memory_order_relaxed);
+        if (count < perSecond) {
+            if (count == 0) _start.store(now(), std::memory_order_relaxed);
+            return true;
+        }
+        int64_t current = now();
+        int64_t start = _start.load(std::memory_order_relaxed);
+        if (current - start < Window) return false;
+        // one caller starts the next window
+        if (!_start.compare_exchange_strong(start, current, std::memory_order_relaxed)) return false;
+        _count.store(1, std::memory_order_relaxed);
+        return perSecond > 0;
+    }
+
+private:
+    static constexpr int64_t Window = 1000000000;
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::atomic<uint64_t> _count{0};
+    std::atomic<int64_t> _start{0};
+};
+
+// Rate limiting and sampling macros
+// Make CALL, any statement such as a call on a stream or a level macro,
+// at most PER_SECOND times a second, or once every K times starting with
+// the first (never if K is 0). State is static to the callsite and shared
+// by all threads. Suppressed calls don't evaluate CALL at all.
+#define CHAR_STREAM_RATE_LIMIT(PER_SECOND, CALL) do { \
+    static CharStreamRateLimit charStreamRateLimit_; \
+    if (charStreamRateLimit_.allow(PER_SECOND)) { CALL; } \
+} while (0)
+#define CHAR_STREAM_SAMPLE(K, CALL) do { \
+    static std::atomic<uint64_t> charStreamSampleCount_{0}; \
+    uint64_t charStreamSampleK_ = (K); \
+    if (charStreamSampleK_ && charStreamSampleCount_.fetch_add(1, std::memory_order_relaxed) % charStreamSampleK_ == 0) { CALL; } \
+} while (0)
+#endif
+
+
+#ifdef CHAR_STREAM_ENABLE_CHECKED_FORMAT
+// Checked format strings
+// Wraps a string literal in a type for CharStream::format, so that it
+// can be parsed and checked at compile time.
+#define CHAR_STREAM_FMT(STR) [] { \
+    struct Fmt { \
+        static constexpr char const * str() { return STR; } \
+    }; \
+    return Fmt{}; \
+}()
+#endif
+
+
+#ifdef CHAR_STREAM_ENABLE_ASYNC
+
+// CharStream whose call operator only copies its (coerced) parameters
+// into a lock-free ring buffer. A background thread formats and writes
+// them with a regular CharStream. Any number of threads can call in.
+class AsyncCharStream {
+public:
+
+    AsyncCharStream(
+        CharStream::Target target = CharStream::Out, 
+        char const * sep = CharStream::DefaultSep, 
+        char const * trm = CharStream::DefaultTrm,
+        bool dropWhenFull = false) :
+        _stream(target, sep, trm),
+        _dropWhenFull(dropWhenFull),
+        _thread(&AsyncCharStream::consume, this) {}
+
+    ~AsyncCharStream() {
+        _running.store(false, std::memory_order_release);
+        _thread.join();
+    }
+
+    AsyncCharStream(AsyncCharStream const &) = delete;
+    AsyncCharStream & operator = (AsyncCharStream const &) = delete;
+
+    // Callop ()
+    // Returns number of bytes queued, 0 if the parameters were dropped.
+    template <typename ... TS>
+    int operator () (TS && ... params) {
+        return push(CharStream::coerceToExpectedParam(static_cast<TS &&>(params))...);
+    }
+
+    // Wait for everything queued so far to be written.
+    void flush() {
+        uint64_t head = _head.load(std::memory_order_acquire);
+        while (_tail.load(std::memory_order_acquire) < head) std::this_thread::yield();
+    }
+
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static constexpr size_t Size = CHAR_STREAM_ASYNC_BUFFER_SIZE & ~(size_t)7;
+    static_assert(Size >= 64, "CHAR_STREAM_ASYNC_BUFFER_SIZE too small");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "AsyncCharStream requires lock-free atomics");
+
+    // Formats a record's parameters with the stream. One per parameter
+    // type list, so it also serves as the call site descriptor.
+    using Format = int (*)(CharStream & stream, char const * data);
+
+    // Records are 8-byte aligned. size is 0 until the record is written,
+    // and the whole record is zeroed again once consumed. Padding records
+    // (format is null) fill the space at the end of the ring.
+    struct Header {
+        std::atomic<uint32_t> size;
+        uint32_t padding;
+        Format format;
+    };
+
+    template <typename ... ES>
+    int push(ES ... values) {
+        // one more, so calls without parameters don't declare an empty array
+        uint32_t sizes[sizeof...(ES) + 1] = {encodedSize(values)..., 0};
+        size_t size = sizeof(Header);
+        for (uint32_t s : sizes) size += s;
+        size = (size + 7) & ~(size_t)7;
+        if (size > Size / 2) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        // claim size bytes, plus padding if it would wrap
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        size_t pad;
+        for (;;) {
+            size_t pos = head % Size;
+            pad = (Size - pos < size) ? Size - pos : 0;
+            if (head + pad + size - _tail.load(std::memory_order_acquire) > Size) {
+                if (_dropWhenFull) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return 0;
+                }
+                std::this_thread::yield();
+                head = _head.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (_head.compare_exchange_weak(head, head + pad + size, std::memory_order_relaxed)) break;
+        }
+        if (pad) {
+            Header * h = header(head);
+            h->padding = 1;
+            h->size.store((uint32_t)pad, std::memory_order_release);
+            head += pad;
+        }
+
+        Header * h = header(head);
+        h->format = &formatRecord<ES...>;
+        char * dst = (char *)(h + 1);
+        size_t index = 0;
+        ((dst = encode(dst, values, sizes[index++])), ...);
+        (void)dst;
+        h->size.store((uint32_t)size, std::memory_order_release);
+        return (int)size;
+    }
+
+    Header * header(uint64_t pos) {
+        return (Header *)(_ring + pos % Size);
+    }
+
+    template <typename E>
+    static uint32_t encodedSize(E) {
+        return sizeof(E);
+    }
+    static uint32_t encodedSize(char const * str) {
+        return sizeof(uint32_t) + (uint32_t)strlen(str) + 1;
+    }
+
+    template <typename E>
+    static char * encode(char * dst, E value, uint32_t size) {
+        memcpy(dst, &value, size);
+        return dst + size;
+    }
+    static char * encode(char * dst, char const * str, uint32_t size) {
+        uint32_t len = size - sizeof(uint32_t) - 1;
+        memcpy(dst, &len, sizeof(uint32_t));
+        memcpy(dst + sizeof(uint32_t), str, len + 1);
+        return dst + size;
+    }
+
+    // returns the value at data, and advances data past it
+    template <typename E>
+    static E decode(char const *& data) {
+        E ret;
+        memcpy(&ret, data, sizeof(E));
+        data += sizeof(E);
+        return ret;
+    }
+
+    template <typename ... ES>
+    static int formatRecord(CharStream & stream, char const * data) {
+        return formatDecoded<ES...>(stream, data, std::index_sequence_for<ES...>{});
+    }
+
+    template <typename ... ES, size_t ... I>
+    static int formatDecoded(CharStream & stream, char const * data, std::index_sequence<I...>) {
+        // braced init is evaluated in order
+        char const * values[] = {decodeAddress<ES>(data)..., nullptr};
+        (void)data;
+        (void)values;
+        return stream(decodeValue<ES>(values[I])...);
+    }
+
+    template <typename E>
+    static char const * decodeAddress(char const *& data) {
+        char const * ret = data;
+        if constexpr (std::is_same_v<E, char const *>) {
+            uint32_t len = decode<uint32_t>(data);
+            data += len + 1;
+        }
+        else {
+            data += sizeof(E);
+        }
+        return ret;
+    }
+
+    template <typename E>
+    static E decodeValue(char const * data) {
+        if constexpr (std::is_same_v<E, char const *>) return data + sizeof(uint32_t);
+        else return decode<E>(data);
+    }
+
+    void consume() {
+        int idle = 0;
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Header * h = header(tail);
+            uint32_t size = h->size.load(std::memory_order_acquire);
+            if (!size) {
+                if (!_running.load(std::memory_order_acquire) && 
+                    tail == _head.load(std::memory_order_acquire)) break;
+                // spin briefly, then back off
+                if (++idle < 64) std::this_thread::yield();
+                else std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            idle = 0;
+            if (!h->padding) h->format(_stream, (char const *)(h + 1));
+            memset((void *)h, 0, size);
+            tail += size;
+            _tail.store(tail, std::memory_order_release);
+        }
+        #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+        _stream.flush();
+        #endif
+    }
+
+    CharStream _stream;
+    bool _dropWhenFull;
+    std::atomic<bool> _running{true};
+    std::atomic<uint64_t> _head{0};
+    std::atomic<uint64_t> _tail{0};
+    std::atomic<uint64_t> _dropped{0};
+    alignas(8) char _ring[Size] = {'\0'};
+    std::thread _thread;
+
+};
+
+#endif
+
+
+#ifdef CHAR_STREAM_ENABLE_BINARY
+
+// Writes compact binary records instead of text, to be turned back into
+// the exact text CharStream would have written by BinaryCharStream::Reader
+// (see tools/CharStreamDecode.cpp).
+//
+// File: "CSB2", config() byte, sep and trm (varint size + bytes), then records.
+// Record: varint (callsite id * 2 + has tags), [count, tags...], values.
+// Each parameter type list gets a callsite id, and its tags are only
+// written with its first record in the file. Values are raw, in host byte
+// order, strings are varint size + bytes.
+class BinaryCharStream {
+public:
+
+    enum Tag : uint8_t {
+        TagBool, TagChar, TagFloat, TagDouble, TagString,
+        TagInt8, TagInt16, TagInt32, TagInt64,
+        TagUint8, TagUint16, TagUint32, TagUint64,
+    };
+
+    static constexpr char Magic[] = "CSB2";
+
+    // Options that change the text of a record, stored in the header so
+    // a Reader built without them can tell
+    enum Config : uint8_t { ConfigNativeFormat = 1, ConfigShortestFloat = 2 };
+    static constexpr uint8_t config() {
+        uint8_t ret = 0;
+        #ifdef CHAR_STREAM_ENABLE_NATIVE_FORMAT
+        ret |= ConfigNativeFormat;
+        #endif
+        #ifdef CHAR_STREAM_ENABLE_SHORTEST_FLOAT
+        ret |= ConfigShortestFloat;
+        #endif
+        return ret;
+    }
+
+    // Constructor
+    // Output is written to fd once CHAR_STREAM_OUTPUT_BUFFER_SIZE bytes
+    // are collected, on flush, or on destruction.
+    BinaryCharStream(
+        int fd = CharStream::Out, 
+        char const * sep = CharStream::DefaultSep, 
+        char const * trm = CharStream::DefaultTrm) :
+        _fd(fd) {
+
+        put(Magic, 4);
+        uint8_t options = config();
+        put(&options, 1);
+        putString(sep);
+        putString(trm);
+    }
+
+    ~BinaryCharStream() {
+        flush();
+    }
+
+    BinaryCharStream(BinaryCharStream const &) = delete;
+    BinaryCharStream & operator = (BinaryCharStream const &) = delete;
+
+    // Callop ()
+    // Returns number of bytes written for this record.
+    template <typename ... TS>
+    int operator () (TS && ... params) {
+        using Tags = TagList<CharStream::ExpectedType<TS>...>;
+        static_assert(sizeof...(TS) < 256, "too many parameters");
+
+        size_t start = _written + _size;
+        uint32_t id = callsiteId<CharStream::ExpectedType<TS>...>();
+        bool hasTags = (id >= CHAR_STREAM_BINARY_MAX_CALLSITES) || !(_defined[id / 8] & (1 << (id % 8)));
+        putVarint((uint64_t)id * 2 + hasTags);
+        if (hasTags) {
+            if (id < CHAR_STREAM_BINARY_MAX_CALLSITES) _defined[id / 8] |= (1 << (id % 8));
+            uint8_t count = sizeof...(TS);
+            put(&count, 1);
+            put(Tags::value, sizeof...(TS));
+        }
+        (putValue<CharStream::ExpectedType<TS>>(static_cast<TS &&>(params)), ...);
+        return (int)(_written + _size - start);
+    }
+
+    void flush() {
+        #ifdef CHAR_STREAM_SYSWRITE
+        if (_size) CHAR_STREAM_SYSWRITE(_fd, _buff, _size);
+        #endif
+        _written += _size;
+        _size = 0;
+    }
+
+    // Turns binary records back into text, written to out. Call read
+    // with consecutive chunks of a file. Returns the number of bytes
+    // used. Any incomplete record at the end of a chunk is not used, and
+    // should be passed again at the start of the next chunk. Returns -1
+    // if the data is not valid.
+    class Reader {
+    public:
+        Reader(CharStream & out) : _out(out) {}
+        Reader(Reader const &) = delete;
+        Reader & operator = (Reader const &) = delete;
+        ~Reader() { free(_record.str); }
+
+        long read(char const * data, size_t size) {
+            char const * p = data;
+            char const * end = data + size;
+            while (p < end) {
+                char const * record = p;
+                int ret = _hasHeader ? readRecord(p, end) : readHeader(p, end);
+                if (ret < 0) return -1;
+                if (ret == 0) return record - data;
+            }
+            return p - data;
+        }
+
+        // whether the data was written with the same config() as this
+        // Reader's, so that its text is exactly what the writer's call
+        // operator would have written. Only valid once the header is read.
+        bool sameConfig() const { return _config == config(); }
+
+    private:
+        // each returns 1 if read, 0 if incomplete, -1 if invalid
+        int readHeader(char const *& p, char const * end) {
+            if (end - p < 5) return 0;
+            if (memcmp(p, Magic, 4) != 0) return -1;
+            _config = (uint8_t)p[4];
+            p += 5;
+            int ret = readHeaderString(p, end, _sep);
+            if (ret <= 0) return ret;
+            ret = readHeaderString(p, end, _trm);
+            if (ret <= 0) return ret;
+            _hasHeader = true;
+            return 1;
+        }
+
+        static int readHeaderString(char const *& p, char const * end, char (&dst)[256]) {
+            uint64_t size;
+            if (!readVarint(p, end, size)) return 0;
+            if (size >= sizeof(dst)) return -1;
+            if ((uint64_t)(end - p) < size) return 0;
+            memcpy(dst, p, size);
+            dst[size] = '\0';
+            p += size;
+            return 1;
+        }
+
+        int readRecord(char const *& p, char const * end) {
+            uint64_t idAndFlag;
+            if (!readVarint(p, end, idAndFlag)) return 0;
+            uint64_t id = idAndFlag / 2;
+            uint8_t count;
+            uint8_t const * tags;
+            if (idAndFlag & 1) {
+                if (p == end) return 0;
+                count = (uint8_t)*p++;
+                if (end - p < count) return 0;
+                tags = (uint8_t const *)p;
+                p += count;
+            }
+            else {
+                if (id >= CHAR_STREAM_BINARY_MAX_CALLSITES || !_counts[id]) return -1;
+                count = (uint8_t)(_counts[id] - 1);
+                tags = _tags[id];
+            }
+
+            // check the whole record is here before writing any of it
+            char const * values = p;
+            for (uint8_t i = 0; i < count; ++i) {
+                int ret = skipValue(tags[i], p, end);
+                if (ret <= 0) return ret;
+            }
+            if ((idAndFlag & 1) && id < CHAR_STREAM_BINARY_MAX_CALLSITES) {
+                memcpy(_tags[id], tags, count);
+                _counts[id] = count + 1;
+            }
+
+            if (count == 0) _line.write("", _trm);
+            p = values;
+            for (uint8_t i = 0; i < count; ++i) {
+                // same rules as CharStream::writeFormatItem
+                char const * sepOrTrm = (i < count - 1) ? _sep : _trm;
+                writeValue(tags[i], p, sepOrTrm);
+            }
+            writeRecord();
+            return 1;
+        }
+
+        // The record's text, assembled in _record, in one call to out.
+        // Truncated like the call operator's output to a standard output,
+        // to CHAR_STREAM_BUFFER_SIZE - 1 bytes unless formatting natively.
+        void writeRecord() {
+            size_t size = _record.size;
+            #ifndef CHAR_STREAM_ENABLE_NATIVE_FORMAT
+            if (size > CHAR_STREAM_BUFFER_SIZE - 1) size = CHAR_STREAM_BUFFER_SIZE - 1;
+            #endif
+            if (size) _out.write("", std::string_view{_record.str, size}, "");
+            _record.clear();
+        }
+
+        static char * growRecord(void *, char * str, size_t, size_t, size_t newCapacity) {
+            return (char *)realloc(str, newCapacity);
+        }
+
+        static int skipValue(uint8_t tag, char const *& p, char const * end) {
+            size_t size;
+            switch (tag) {
+            case TagBool: case TagChar: case TagInt8: case TagUint8: size = 1; break;
+            case TagInt16: case TagUint16: size = 2; break;
+            case TagFloat: case TagInt32: case TagUint32: size = 4; break;
+            case TagDouble: case TagInt64: case TagUint64: size = 8; break;
+            case TagString: {
+                uint64_t len;
+                if (!readVarint(p, end, len)) return 0;
+                size = len;
+                break;
+            }
+            default: return -1;
+            }
+            if ((size_t)(end - p) < size) return 0;
+            p += size;
+            return 1;
+        }
+
+        template <typename E>
+        static E get(char const *& p) {
+            E ret;
+            memcpy(&ret, p, sizeof(E));
+            p += sizeof(E);
+            return ret;
+        }
+
+        void writeValue(uint8_t tag, char const *& p, char const * sepOrTrm) {
+            switch (tag) {
+            case TagBool:   _line.write("", get<bool>(p), sepOrTrm); break;
+            case TagChar:   _line.write("", get<char>(p), sepOrTrm); break;
+            case TagFloat:  _line.write("", get<float>(p), sepOrTrm); break;
+            case TagDouble: _line.write("", get<double>(p), sepOrTrm); break;
+            case TagInt8:   _line.write("", get<int8_t>(p), sepOrTrm); break;
+            case TagInt16:  _line.write("", get<int16_t>(p), sepOrTrm); break;
+            case TagInt32:  _line.write("", get<int32_t>(p), sepOrTrm); break;
+            case TagInt64:  _line.write("", get<int64_t>(p), sepOrTrm); break;
+            case TagUint8:  _line.write("", get<uint8_t>(p), sepOrTrm); break;
+            case TagUint16: _line.write("", get<uint16_t>(p), sepOrTrm); break;
+            case TagUint32: _line.write("", get<uint32_t>(p), sepOrTrm); break;
+            case TagUint64: _line.write("", get<uint64_t>(p), sepOrTrm); break;
+            case TagString: {
+                uint64_t len;
+                readVarint(p, p + 10, len);
+                _line.format("%.*s%s", (int)len, p, sepOrTrm);
+                p += len;
+                break;
+            }
+            }
+        }
+
+        static constexpr uint8_t MaxParams = 255;
+
+        CharStream & _out;
+        CharStream::GrowableBuffer _record{nullptr, growRecord};
+        CharStream _line{_record, "", ""};
+        bool _hasHeader = false;
+        uint8_t _config = 0;
+        char _sep[256];
+        char _trm[256];
+        uint16_t _counts[CHAR_STREAM_BINARY_MAX_CALLSITES] = {0}; // param count + 1
+        uint8_t _tags[CHAR_STREAM_BINARY_MAX_CALLSITES][MaxParams];
+    };
+
+private:
+
+    template <typename E>
+    static constexpr uint8_t tagFor() {
+        if constexpr (std::is_same_v<E, bool>) return TagBool;
+        else if constexpr (std::is_same_v<E, char>) return TagChar;
+        else if constexpr (std::is_same_v<E, float>) return TagFloat;
+        else if constexpr (std::is_same_v<E, double>) return TagDouble;
+        else if constexpr (std::is_same_v<E, char const *>) return TagString;
+        else if constexpr (std::is_signed_v<E>) {
+            return sizeof(E) == 1 ? TagInt8 : sizeof(E) == 2 ? TagInt16 : sizeof(E) == 4 ? TagInt32 : TagInt64;
+        }
+        else {
+            return sizeof(E) == 1 ? TagUint8 : sizeof(E) == 2 ? TagUint16 : sizeof(E) == 4 ? TagUint32 : TagUint64;
+        }
+    }
+
+    template <typename ... ES>
+    struct TagList {
+        static constexpr uint8_t value[sizeof...(ES) + 1] = {tagFor<ES>()..., 0};
+    };
+
+    template <typename ... ES>
+    static uint32_t callsiteId() {
+        static uint32_t id = _nextId.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    template <typename E, typename T>
+    void putValue(T && param) {
+        E value = static_cast<T &&>(param);
+        if constexpr (std::is_same_v<E, char const *>) putString(value);
+        else put(&value, sizeof(E));
+    }
+
+    void putString(char const * str) {
+        size_t size = strlen(str);
+        putVarint(size);
+        put(str, size);
+    }
+
+    void putVarint(uint64_t value) {
+        uint8_t bytes[10];
+        size_t size = 0;
+        do {
+            bytes[size] = value & 0x7f;
+            value >>= 7;
+            if (value) bytes[size] |= 0x80;
+            ++size;
+        } while (value);
+        put(bytes, size);
+    }
+
+    void put(void const * data, size_t size) {
+        if (CHAR_STREAM_OUTPUT_BUFFER_SIZE - _size < size) {
+            flush();
+            if (size > CHAR_STREAM_OUTPUT_BUFFER_SIZE) {
+                #ifdef CHAR_STREAM_SYSWRITE
+                CHAR_STREAM_SYSWRITE(_fd, data, size);
+                #endif
+                _written += size;
+                return;
+            }
+        }
+        memcpy(_buff + _size, data, size);
+        _size += size;
+    }
+
+    static bool readVarint(char const *& p, char const * end, uint64_t & value) {
+        value = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t byte = (uint8_t)*p++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static inline std::atomic<uint32_t> _nextId{0};
+
+    int _fd;
+    size_t _size = 0;
+    size_t _written = 0;
+    uint8_t _defined[(CHAR_STREAM_BINARY_MAX_CALLSITES + 7) / 8] = {0};
+    char _buff[CHAR_STREAM_OUTPUT_BUFFER_SIZE];
+
+};
+
+#endif
+
+
+#ifdef CHAR_STREAM_ENABLE_OPERATOR_MACRO
+
+// Each thread gets its own buffer, so conversions on different threads
+// never share memory. Define as static to share one buffer between all
+// threads, only safe if conversions are made from a single thread.
+#ifndef CHAR_STREAM_OPERATOR_STORAGE
+#define CHAR_STREAM_OPERATOR_STORAGE static thread_local
+#endif
 
 template <typename ST, ST N>
 class CharLoop {
@@ -245,7 +3753,7 @@ private:
 };
 
 #define CHAR_STREAM_OPERATOR(SIZE, COUNT, FORMAT, ...) operator char const * () { \
-    static CharLoop<uint16_t, SIZE * COUNT> buff; \
+    CHAR_STREAM_OPERATOR_STORAGE CharLoop<uint16_t, SIZE * COUNT> buff; \
     auto ret = buff.claim(SIZE); \
     CHAR_STREAM_SPRINTF(ret, FORMAT, __VA_ARGS__); \
     return ret.ptr(); \
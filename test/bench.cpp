@@ -0,0 +1,122 @@
+// Measures ns/call and MB/s for CharStream against printf, iostream and
+// calling the sprintf backend directly, for a few argument mixes, writing
+// to standard output and to a string. Standard output is expected to be
+// redirected (buildbench sends it to /dev/null); results go to stderr.
+// In the "std" rows all three buffer in user space, CharStream with
+// buffer() into BUFSIZ bytes like stdio, so each compares formatting and
+// not how often write(2) is called.
+// Build once per backend: defining BENCH_STB_SPRINTF selects stbsp_sprintf
+// instead of libc sprintf. Pass an iteration count to override the default.
+
+#include <stdio.h>
+
+#ifdef BENCH_STB_SPRINTF
+#define STB_SPRINTF_IMPLEMENTATION
+#include "stb_sprintf.h"
+#define CHAR_STREAM_SPRINTF stbsp_sprintf
+#define CHAR_STREAM_SNPRINTF stbsp_snprintf
+#define BENCH_BACKEND "stb_sprintf"
+#else
+#define BENCH_BACKEND "sprintf"
+#endif
+
+#define CHAR_STREAM_ENABLE_OPERATOR_MACRO
+#define CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+#define CHAR_STREAM_OUTPUT_BUFFER_SIZE BUFSIZ
+#include "../CharStream.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+
+struct IntPair {
+    int a, b;
+    IntPair(int a, int b) : a(a), b(b) {}
+    CHAR_STREAM_OPERATOR(32, 8, "(%d, %d)", a, b)
+};
+
+
+// Parameters are globals so calls can't be folded into constants
+int     intA = 42, intB = -1234567, intC = 7;
+int64_t intD = -4300000000;
+char const * strA = "alpha";
+char const * strB = "a somewhat longer string parameter";
+double  floatA = 3.14159, floatB = -0.001;
+IntPair pairA{1, 2}, pairB{-30, 40};
+
+char    buff[1024];
+long    iterations = 200000;
+volatile long sink;
+
+
+CharStream Report(CharStream::Err);
+
+// Runs fn iterations times, fn returns the number of bytes it wrote
+template <typename FN>
+void run(char const * mix, char const * target, char const * name, FN && fn) {
+    long bytes = 0;
+    for (long i = 0; i < iterations / 10; ++i) bytes += fn();
+    bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) bytes += fn();
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    sink = bytes;
+    Report.format("%-8s %-7s %-12s %9.1f ns/call %9.1f MB/s\n",
+        mix, target, name, ns.count() / iterations, bytes * 1e3 / ns.count());
+}
+
+// Bytes an iostream insertion writes, as std::cout doesn't report it
+template <typename FN>
+long streamSize(FN && fn) {
+    std::ostringstream os;
+    fn(os);
+    return (long)os.tellp();
+}
+
+
+#define BENCH_MIX(MIX, FMT, ...) \
+    { \
+        CharStream Out; \
+        Out.buffer(); \
+        run(MIX, "std", "CharStream", [&] { return Out(__VA_ARGS__); }); \
+        Out.flush(); \
+        run(MIX, "std", "printf", [&] { return printf(FMT "\n", __VA_ARGS__); }); \
+        auto insert = [&](std::ostream & os) { BENCH_INSERT(os, __VA_ARGS__); os << '\n'; }; \
+        long size = streamSize(insert); \
+        run(MIX, "std", "iostream", [&] { insert(std::cout); return size; }); \
+        fflush(stdout); \
+        std::cout.flush(); \
+        \
+        CharStream Str(buff); \
+        run(MIX, "string", "CharStream", [&] { return Str(__VA_ARGS__); }); \
+        run(MIX, "string", BENCH_BACKEND, [&] { return CHAR_STREAM_SPRINTF(buff, FMT "\n", __VA_ARGS__); }); \
+        std::ostringstream os; \
+        run(MIX, "string", "iostream", [&] { os.str(""); insert(os); return (long)os.tellp(); }); \
+        Report(); \
+    }
+
+template <typename T>
+void insertAll(std::ostream & os, T const & t) { os << t; }
+template <typename T, typename ... TS>
+void insertAll(std::ostream & os, T const & t, TS const & ... ts) { os << t << ' '; insertAll(os, ts...); }
+#define BENCH_INSERT(OS, ...) insertAll(OS, __VA_ARGS__)
+
+
+
+
+int main(int argc, char ** argv) {
+    if (argc > 1) iterations = atol(argv[1]);
+    std::ios::sync_with_stdio(false);
+    Report("backend", BENCH_BACKEND, "iterations", (int)iterations, "\n");
+
+    BENCH_MIX("ints", "%d %d %d %" PRId64, intA, intB, intC, intD)
+    BENCH_MIX("strings", "%s %s %s", strA, strB, strA)
+    BENCH_MIX("floats", "%f %f", floatA, floatB)
+    BENCH_MIX("custom", "%s %s", (char const *)pairA, (char const *)pairB)
+    BENCH_MIX("mixed", "%d %s %f %s", intA, strA, floatA, (char const *)pairA)
+
+    return 0;
+}
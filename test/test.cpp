@@ -6,8 +6,28 @@
 #define CHAR_STREAM_BUFFER_SIZE STB_SPRINTF_MIN
 #define CHAR_STREAM_FORMAT_BUFFER_SIZE 64
 #define CHAR_STREAM_SPRINTF stbsp_sprintf
+#define CHAR_STREAM_SNPRINTF stbsp_snprintf
 #define CHAR_STREAM_ENABLE_OPERATOR_MACRO
+#define CHAR_STREAM_ENABLE_SHORTEST_FLOAT
+#define CHAR_STREAM_ENABLE_STATS
+#define CHAR_STREAM_ENABLE_MAPPED_FILE
+#define CHAR_STREAM_ENABLE_ROTATING_FILE
+#define CHAR_STREAM_ENABLE_HEX_DUMP
+#define CHAR_STREAM_ENABLE_PARALLEL
+#define CHAR_STREAM_ENABLE_CHECKED_FORMAT
+#define CHAR_STREAM_ENABLE_TEE
+#define CHAR_STREAM_ENABLE_COMPRESS
+#define CHAR_STREAM_ENABLE_RATE_LIMIT
+#define CHAR_STREAM_ENABLE_ASYNC
+#define CHAR_STREAM_ENABLE_BINARY
+#define CHAR_STREAM_PARALLEL_CHUNK_SIZE 4
+#ifdef __linux__
+#define CHAR_STREAM_ENABLE_URING
+#endif
 #include "../CharStream.h"
+#include <string>
+#include <thread>
+#include <vector>
 
 
 struct IntPair {
@@ -16,6 +36,29 @@ struct IntPair {
     CHAR_STREAM_OPERATOR(32, 8, "(%d, %d)", a, b)
 };
 
+// Stream sink appending to a std::string
+struct AppendSink {
+    std::string * str;
+    void write(char const * data, size_t size) { str->append(data, size); }
+};
+
+// Writes a record of sizeof...(I) int parameters
+template <size_t ... I>
+void writeInts(BinaryCharStream & stream, std::index_sequence<I...>) {
+    stream((int)I...);
+}
+
+struct Coord {
+    int x, y;
+    void writeTo(CharStream::Writer & w) const {
+        w.write('[');
+        w.writeValue(x);
+        w.write(", ");
+        w.writeValue(y);
+        w.write(']');
+    }
+};
+
 
 
 
@@ -43,6 +86,20 @@ int main() {
     IntPair bar{3, 4};
 
     Log(foo, bar);
+    // each thread converts into its own buffer
+    std::atomic<int> wrong{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) threads.emplace_back([t, &wrong] {
+        char expected[32];
+        for (int i = 0; i < 20000; ++i) {
+            IntPair pair{t, i};
+            char const * str = pair;
+            snprintf(expected, sizeof(expected), "(%d, %d)", t, i);
+            if (strcmp(str, expected)) ++wrong;
+        }
+    });
+    for (auto & thread : threads) thread.join();
+    Log("wrong conversions on 4 threads", wrong.load());
     Log();
 
 
@@ -60,8 +117,386 @@ int main() {
     Log("Format function\n----------------");
 
     Log.format("(%d%d%d)\n", 1, 2, 3);
+    Log.format(CHAR_STREAM_FMT("[%-6s|%4d|%03u|%x] 100%%\n"), "left", -42, 7u, 255);
     Log(1, 2, 3);
     Log();
 
+
+    #ifdef CHAR_STREAM_ENABLE_STATIC_FORMAT
+    // Static format
+    Log("Static format\n----------------");
+
+    // default sep and trm spliced into the compile-time format
+    Log(1, "two", 3u, 'c', true);
+    // others passed as "%s" parameters
+    CharStream Custom{CharStream::Out, ", ", ";\n"};
+    Custom(1, "two", 3u, 'c', true);
+    Log.write("-", 5, 6, "\n");
+    Log();
+    #endif
+
+
+    // String buffer
+    Log("String buffer\n----------------");
+
+    char strBuff[32];
+    CharStream::StringBuffer str{strBuff};
+    CharStream Str{str, ", ", ";"};
+    Str(1, "two");
+    Str(3);
+    Str("will be truncated at capacity");
+    Log(str.size, strBuff);
+    // longer than the room left, which is more than CHAR_STREAM_BUFFER_SIZE
+    static char longBuff[256];
+    char longValue[301];
+    memset(longValue, 'x', 300);
+    longValue[300] = '\0';
+    CharStream::StringBuffer longStr{longBuff};
+    CharStream Long{longStr};
+    Long("start");
+    Long(longValue);
+    Log(longStr.size, (int)strlen(longBuff), std::string_view(longBuff + 240));
+    Log();
+
+
+    // Growable buffer
+    Log("Growable buffer\n----------------");
+
+    static char arenaMem[4096];
+    CharStream::Arena arena{arenaMem};
+    CharStream::GrowableBuffer growable{arena};
+    CharStream Growable{growable};
+    for (int i = 0; i < 100; ++i) Growable(i);
+    Log(growable.size, growable.capacity, arena.used);
+    growable.clear();
+    Growable("cleared");
+    Log(growable.str);
+    // longer than CHAR_STREAM_BUFFER_SIZE
+    Growable(longValue);
+    Log(growable.size, growable.capacity, (int)strlen(growable.str));
+    // another buffer on the arena moves the block partway through a
+    // call, which keeps what the call had written so far
+    static char sharedMem[8192];
+    CharStream::Arena shared{sharedMem};
+    CharStream::GrowableBuffer first{shared};
+    CharStream::GrowableBuffer second{shared};
+    CharStream First{first};
+    First("first");
+    CharStream{second}("second");
+    std::vector<int> ints{1, 2, 3};
+    First(std::string_view("head"), std::string(3000, 'x'), ints);
+    Log(first.size, (int)strlen(first.str), std::string_view(first.str + 6, 6), first.str + first.size - 5);
+
+
+    #ifdef CHAR_STREAM_ENABLE_NATIVE_FORMAT
+    // Native format
+    Log("Native format\n----------------");
+
+    // unsigned values over the signed maximum are written unsigned,
+    // unlike the "%d"/"%ld" of CHAR_STREAM_SPRINTF
+    Log((uint64_t)-1, (uint32_t)-1, (int64_t)INT64_MIN, (int8_t)-128, (uint8_t)255);
+    // longer than CHAR_STREAM_BUFFER_SIZE, written in pieces
+    Log(longValue, "end");
+    Log();
+    #endif
+
+
+    #ifdef CHAR_STREAM_ENABLE_BUFFERED_OUTPUT
+    // Buffered output
+    Log("Buffered output\n----------------");
+
+    {
+        std::string out;
+        BasicCharStream<AppendSink> Buffered{AppendSink{&out}};
+        Buffered.buffer();
+        // lines longer than CHAR_STREAM_BUFFER_SIZE, some not fitting in
+        // the room left in the buffer
+        for (int i = 0; i < 30; ++i) Buffered(longValue, i);
+        Log("before flush", (int)out.size(), "written", Buffered.stats().syscalls, "times");
+        Buffered.flush();
+        Log("after flush", (int)out.size(), "written", Buffered.stats().syscalls, "times");
+        Buffered.buffer(CHAR_STREAM_OUTPUT_BUFFER_SIZE, 2);
+        Buffered("two lines");
+        Buffered("flushed");
+        Log("by lines", (int)out.size(), out.substr(out.size() - 18));
+    }
+    Log();
+    #endif
+
+
+    // Levels
+    Log("Levels\n----------------");
+
+    Log.setLevel(CharStream::Info);
+    Log.debug("not shown");
+    CHAR_STREAM_DEBUG(Log, "not shown");
+    Log.info("info");
+    CHAR_STREAM_WARN(Log, "warn", 1);
+    for (int i = 0; i < 10; ++i) {
+        CHAR_STREAM_SAMPLE(4, Log.info("sampled", i));
+        CHAR_STREAM_SAMPLE(0, Log.info("never sampled", i));
+        CHAR_STREAM_RATE_LIMIT(2, CHAR_STREAM_WARN(Log, "rate limited", i));
+    }
+    Log.setLevel(CharStream::Debug);
+    Log();
+
+
+    // Floats
+    Log("Floats\n----------------");
+
+    using Float = CharStream::Float;
+    Log(Float(0.1), Float(0.1f), Float(1e100), Float(-2.5e-7f), Float(100.0));
+    Log(Float(3.14159, 2), Float(-2.5, 0), Float(1e21, 1));
+    // the maximum precision, and over it
+    Log(Float(0.01, CharStream::FloatMaxPrecision), Float(1.5, 25), Float(-1e300, 19).size);
+    Log();
+
+
+    // Stats
+    Log("Stats\n----------------");
+
+    char small[16];
+    CharStream::StringBuffer smallBuffer{small};
+    CharStream Small{smallBuffer};
+    Small("fits");
+    Small("does not fit");
+    CharStream::Stats stats = Small.stats();
+    Log("calls", stats.calls, "bytes", stats.bytes, "truncations", stats.truncations);
+    Log();
+
+
+    // Direct to output
+    Log("Direct to output\n----------------");
+
+    Coord coord{-3, 14};
+    Log(coord, Coord{1, 2}, "between", 5);
+    Log.write(" | ", coord, coord, "\n");
+    Log();
+
+
+    // Sinks
+    Log("Sinks\n----------------");
+
+    uint64_t callsBefore = CharStream::globalStats().calls;
+    FdCharStream Fd(CharStream::Out);
+    Fd("fd sink", coord, CharStream::Float{1.5f});
+    char line[64];
+    StrCharStream Line(line, ", ", "");
+    Line("str sink", 7, 8);
+    // counted with all the others
+    uint64_t sinkCalls = CharStream::globalStats().calls - callsBefore;
+    Log(line);
+    Log("global calls", sinkCalls);
+    char teeMem[64];
+    CharStream::StringBuffer teeBuffer(teeMem);
+    CharStream TeeBuffer(teeBuffer);
+    TeeBuffer.setLevel(CharStream::Warn);
+    TeeCharStream<CharStream, CharStream> Tee({Log, TeeBuffer});
+    Tee.info("tee info");
+    Tee.warn("tee warn");
+    Log.format("%s", teeMem);
+    std::string packed;
+    {
+        CompressCharStream<AppendSink> Packed(AppendSink{&packed});
+        for (int i = 0; i < 4; ++i) Packed("compress sink, repeated line", i);
+    }
+    uint32_t packedSize, rawSize;
+    CharStreamLZ::readHeader(packed.data(), packedSize, rawSize);
+    char raw[256];
+    long rawLength = CharStreamLZ::decompress(packed.data() + CharStreamLZ::HeaderSize, packedSize, raw, sizeof(raw));
+    Log("packed", (int)packed.size(), "raw", (int)rawLength);
+    Log.write("", std::string_view(raw, rawLength));
+    Log();
+
+
+    // Sized strings
+    Log("Sized strings\n----------------");
+
+    std::string_view view{"first word only", 5};
+    char unterminated[3] = {'a', 'b', 'c'};
+    Log(view, std::string{"std::string"}, 42);
+    Log.write("", view, unterminated, "\n");
+    // the other parameters are written the same as without one
+    char plain[64];
+    char mixed[64];
+    CharStream::StringBuffer plainBuff{plain};
+    CharStream::StringBuffer mixedBuff{mixed};
+    CharStream{plainBuff}.write(" ", 4000000000u, (uint64_t)-1, (int8_t)-5, 'c', true, "end", "");
+    CharStream{mixedBuff}.write(" ", 4000000000u, (uint64_t)-1, (int8_t)-5, 'c', true, std::string_view{"end"}, "");
+    Log(plain);
+    Log(mixed);
+    Log(strcmp(plain, mixed) == 0);
+    Log();
+
+
+    // Containers
+    Log("Containers\n----------------");
+
+    int numbers[] = {3, -1, 4, -1, 5};
+    std::vector<uint16_t> samples{100, 200, 65535};
+    Log("numbers", numbers, "samples", samples);
+    Log.write(", ", CharStream::Span{numbers + 1, 3}, "\n");
+    std::vector<int> squares;
+    for (int i = 0; i < 20; ++i) squares.push_back(i * i);
+    Log("parallel", CharStream::Parallel{squares, 3});
+    Log();
+
+
+    // Byte dumps
+    Log("Byte dumps\n----------------");
+
+    char const packet[] = "GET /index.html HTTP/1.1\r\n\x00\xff";
+    Log("hex", CharStream::Hex{packet, 8}, "base64", CharStream::Base64{packet, 8});
+    Log(CharStream::HexDump{packet, sizeof(packet)});
+    Log();
+
+
+    // Mapped file
+    Log("Mapped file\n----------------");
+
+    {
+        CharStream::MappedFile file{"mapped.log"};
+        CharStream Mapped{file};
+        for (int i = 0; i < 1000; ++i) Mapped("line", i);
+        Log("open", file.isOpen(), "length", file.length());
+    }
+    remove("mapped.log");
+    {
+        // lines longer than CHAR_STREAM_BUFFER_SIZE, across small windows
+        CharStream::MappedFile file{"mapped.log", false, 4096};
+        CharStream Mapped{file};
+        for (int i = 0; i < 30; ++i) Mapped(longValue, i);
+        Log("long lines, length", file.length());
+    }
+    remove("mapped.log");
+    Log();
+
+
+    // Rotating file
+    Log("Rotating file\n----------------");
+
+    uint32_t segments;
+    {
+        CharStream::RotatingFile file{"rotating.%u.log", 4096};
+        CharStream Rotating{file};
+        for (int i = 0; i < 1000; ++i) Rotating("line", i);
+        segments = file.index() + 1;
+        Log("segments", segments);
+    }
+    for (uint32_t i = 0; i < segments; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "rotating.%u.log", i);
+        remove(name);
+    }
+    {
+        // lines longer than CHAR_STREAM_BUFFER_SIZE, with the first
+        // segment on descriptor 0
+        int savedIn = dup(0);
+        close(0);
+        {
+            CharStream::RotatingFile file{"rotating.%u.log", 4096};
+            CharStream Rotating{file};
+            for (int i = 0; i < 30; ++i) Rotating(longValue, i);
+            segments = file.index() + 1;
+        }
+        dup2(savedIn, 0);
+        close(savedIn);
+        long length = 0;
+        bool whole = true;
+        for (uint32_t i = 0; i < segments; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "rotating.%u.log", i);
+            FILE * file = fopen(name, "rb");
+            fseek(file, -1, SEEK_END);
+            whole = whole && fgetc(file) == '\n';
+            length += ftell(file);
+            fclose(file);
+            remove(name);
+        }
+        Log("long lines, segments", segments, "length", length, "whole lines", whole);
+    }
+    Log();
+
+
+    // Async
+    Log("Async\n----------------");
+
+    {
+        char asyncMem[64];
+        CharStream::StringBuffer asyncBuffer{asyncMem};
+        AsyncCharStream Async{asyncBuffer, " ", ";"};
+        Async("queued", 1, 2);
+        Async();
+        Async("done");
+        Async.flush();
+        Log(asyncMem, Async.dropped());
+    }
+    Log();
+
+
+    // Binary
+    Log("Binary\n----------------");
+
+    {
+        int fd = open("binary.log", O_RDWR | O_CREAT | O_TRUNC, 0644);
+        {
+            BinaryCharStream Bin{fd, ", ", ";\n"};
+            Bin("binary", 1, -2, 'c', true);
+            Bin("binary", 3, -4, 'd', false);
+            Bin();
+            // the most parameters a record can have, twice to use the
+            // stored tags
+            writeInts(Bin, std::make_index_sequence<255>());
+            writeInts(Bin, std::make_index_sequence<255>());
+        }
+        static char data[4096];
+        long size = (long)pread(fd, data, sizeof(data), 0);
+        close(fd);
+        remove("binary.log");
+
+        static char decodedMem[4096];
+        CharStream::StringBuffer decoded{decodedMem};
+        CharStream Decoded{decoded};
+        static BinaryCharStream::Reader reader{Decoded};
+        long used = reader.read(data, size);
+        Log("used", used, "of", size, "same config", reader.sameConfig());
+        // one call per record
+        Log("records", Decoded.stats().calls);
+        char const * first = strstr(decodedMem, "0, 1, 2");
+        Log.write("", std::string_view(decodedMem, first - decodedMem));
+        // both long records, the same, and truncated like the text
+        // written to a standard output
+        size_t length = (decodedMem + decoded.size - first) / 2;
+        Log(length, std::string_view(first, 10), std::string_view(first + length - 12, 10),
+            !memcmp(first, first + length, length));
+    }
+    Log();
+
+
+    #ifdef CHAR_STREAM_ENABLE_URING
+    // io_uring
+    Log("io_uring\n----------------");
+
+    {
+        CharStream::UringFile out{CharStream::Out};
+        CharStream Uring{out};
+        Uring("queued", 1);
+        Uring("queued", 2);
+    }
+    {
+        // lines longer than CHAR_STREAM_BUFFER_SIZE, across buffers
+        int fd = open("uring.log", O_RDWR | O_CREAT | O_TRUNC, 0644);
+        {
+            CharStream::UringFile file{fd};
+            CharStream Uring{file};
+            for (int i = 0; i < 500; ++i) Uring(longValue, i);
+        }
+        Log("long lines, length", (long)lseek(fd, 0, SEEK_END));
+        close(fd);
+        remove("uring.log");
+    }
+    Log();
+    #endif
+
     return 0;
 }
@@ -0,0 +1,55 @@
+// Turns a BinaryCharStream file back into text.
+// Usage: CharStreamDecode [file]    (reads stdin if no file given)
+// Build with the same CHAR_STREAM_BUFFER_SIZE,
+// CHAR_STREAM_ENABLE_NATIVE_FORMAT and CHAR_STREAM_ENABLE_SHORTEST_FLOAT
+// options as the writer (passed on by buildtools) for the exact same text.
+
+#include <stdio.h>
+
+#define CHAR_STREAM_ENABLE_BINARY
+#include "../CharStream.h"
+
+
+static BinaryCharStream::Reader * reader;
+static char data[1 << 20];
+
+
+int main(int argc, char ** argv) {
+    FILE * file = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    CharStream Log;
+    reader = new BinaryCharStream::Reader{Log};
+
+    size_t size = 0;
+    for (;;) {
+        size_t ret = fread(data + size, 1, sizeof(data) - size, file);
+        size += ret;
+        long used = reader->read(data, size);
+        if (used < 0) {
+            fprintf(stderr, "invalid data\n");
+            return 1;
+        }
+        // keep the incomplete record for the next chunk
+        memmove(data, data + used, size - used);
+        size -= used;
+        if (ret == 0) break;
+        if (size == sizeof(data)) {
+            fprintf(stderr, "record too large\n");
+            return 1;
+        }
+    }
+    if (size) {
+        fprintf(stderr, "incomplete record at end of file\n");
+        return 1;
+    }
+    if (!reader->sameConfig()) {
+        fprintf(stderr, "warning: written with other formatting options, text may differ\n");
+    }
+
+    delete reader;
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Turns a CompressCharStream file back into text.
+// Usage: CharStreamDecompress [file]    (reads stdin if no file given)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHAR_STREAM_ENABLE_COMPRESS
+#include "../CharStream.h"
+
+
+int main(int argc, char ** argv) {
+    FILE * file = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    char * packed = (char *)malloc(CharStreamLZ::MaxBlockSize);
+    char * raw = (char *)malloc(CharStreamLZ::MaxBlockSize);
+    char header[CharStreamLZ::HeaderSize];
+    for (;;) {
+        size_t ret = fread(header, 1, sizeof(header), file);
+        if (ret == 0) break;
+        if (ret < sizeof(header)) {
+            fprintf(stderr, "incomplete block at end of file\n");
+            return 1;
+        }
+        uint32_t packedSize, rawSize;
+        CharStreamLZ::readHeader(header, packedSize, rawSize);
+        bool stored = packedSize & CharStreamLZ::StoredFlag;
+        packedSize &= ~CharStreamLZ::StoredFlag;
+        if (rawSize > CharStreamLZ::MaxBlockSize || packedSize > CharStreamLZ::MaxBlockSize) {
+            fprintf(stderr, "invalid data\n");
+            return 1;
+        }
+        if (fread(packed, 1, packedSize, file) < packedSize) {
+            fprintf(stderr, "incomplete block at end of file\n");
+            return 1;
+        }
+        if (stored) {
+            if (packedSize != rawSize) {
+                fprintf(stderr, "invalid data\n");
+                return 1;
+            }
+            fwrite(packed, 1, packedSize, stdout);
+            continue;
+        }
+        if (CharStreamLZ::decompress(packed, packedSize, raw, rawSize) != (long)rawSize) {
+            fprintf(stderr, "invalid data\n");
+            return 1;
+        }
+        fwrite(raw, 1, rawSize, stdout);
+    }
+
+    free(packed);
+    free(raw);
+    return 0;
+}